@@ -0,0 +1,351 @@
+// Copyright © 2021, SAS Institute Inc., Cary, NC, USA.  All Rights Reserved.
+// SPDX-License-Identifier: Apache-2.0
+
+
+// -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 4 -*-
+
+/**
+ * \file dfESPbfileCheckpoint.h
+ *
+ * \brief Progress journal and active/standby election of the bfile publisher.
+ *
+ * The instance holding the flock on <checkpoint>.lock is the active one, the
+ * others wait in waitForLock() and keep reading the journal. The journal is a
+ * text file with one line per event, the state is the fold of its lines:
+ *
+ *     p <TAB> next event ID <TAB> repeat count left <TAB> file name
+ *     m <TAB> next event ID <TAB> repeat count left <TAB> next manifest line
+ *     f <TAB> next event ID <TAB> inode <TAB> bytes published <TAB> followed file name
+ *
+ * The active instance queues the line of each event when the event is built
+ * and commits the queued lines once its event block is injected, so that the
+ * journal never gets ahead of what was actually published. compact() rewrites
+ * the journal from the state when it becomes mostly redundant, which a reader
+ * detects by the new inode. This header has no SAS Event Stream Processing
+ * dependency, so that tools/bfile_failover_bench can exercise it directly.
+ */
+
+#ifndef __dfESPbfileCheckpoint__
+#define __dfESPbfileCheckpoint__
+
+#include <cerrno>
+#include <climits>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <map>
+#include <set>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * Checkpointed position of a followed file
+ */
+struct dfESPbfileCheckpointPos_t {
+    uint64_t inode = 0;
+    int64_t  done  = 0;              // bytes published
+};
+
+/**
+ * \class dfESPbfileCheckpoint
+ *
+ * \brief Journal file and lock shared by an active publisher and its standby instances.
+ */
+class dfESPbfileCheckpoint {
+public:
+    //
+    // state read from the journal, the owner may forget entries: they are left out at the next compaction
+    //
+    int64_t     frameNumber  = 0;          // next event ID, 0 = no progress yet
+    int32_t     repeatCount  = INT32_MIN;  // INT32_MIN = no p or m line yet
+    int64_t     manifestLine = -1;         // next manifest line, -1 = no m line yet
+    std::string lastName;                  // last file published, the resume position
+    std::set<std::string> processed;
+    std::map<std::string, dfESPbfileCheckpointPos_t> followed;
+
+    dfESPbfileCheckpoint() {}
+    ~dfESPbfileCheckpoint() { close(); }
+
+    /**
+     * Open the lock file of the checkpoint, without taking the lock
+     * @param path the checkpoint file
+     * @param interval events between two flushes of the journal
+     * @return bool true = success, false = failure, see errno
+     */
+    bool open(const std::string &path, int32_t interval) {
+        close();
+        _path = path;
+        _interval = interval > 0 ? interval : 1;
+        _lockFd = ::open((path + ".lock").c_str(), O_CREAT | O_RDWR, 0666);
+        return _lockFd >= 0;
+    }
+
+    /**
+     * Take the lock, reading the journal every 10ms while another instance holds it
+     * @param keepWaiting called after each read of the journal, false stops waiting
+     * @return bool true = this instance is active, false = keepWaiting returned false
+     */
+    bool waitForLock(const std::function<bool()> &keepWaiting) {
+        while (flock(_lockFd, LOCK_EX | LOCK_NB) != 0) {
+            load();
+            if (!keepWaiting()) {
+                return false;
+            }
+            usleep(10000);
+        }
+        return true;
+    }
+
+    /**
+     * Apply the journal lines written since the last call, the journal is read incrementally
+     * @return bool true = success, false = read error
+     */
+    bool load() {
+        struct stat st;
+        if (stat(_path.c_str(), &st) != 0) {
+            return errno == ENOENT; // no checkpoint yet
+        }
+        if (st.st_ino != _inode || st.st_size < _readOffset) {
+            // a new inode means the active instance compacted the journal
+            _inode = st.st_ino;
+            _readOffset = 0;
+            _partial.clear();
+            _lines = 0;
+            frameNumber = 0;
+            repeatCount = INT32_MIN;
+            manifestLine = -1;
+            lastName.clear();
+            processed.clear();
+            followed.clear();
+        }
+        if (st.st_size == _readOffset) {
+            return true;
+        }
+        FILE *file = fopen(_path.c_str(), "r");
+        if (file == nullptr) {
+            return false;
+        }
+        if (fseek(file, _readOffset, SEEK_SET) != 0) {
+            fclose(file);
+            return false;
+        }
+        char chunk[65536];
+        size_t n;
+        while ((n = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+            _readOffset += n;
+            _partial.append(chunk, n);
+            // complete lines only, the active instance may be writing the last one
+            _partial.erase(0, applyLines(_partial));
+        }
+        fclose(file);
+        return true;
+    }
+
+    /**
+     * Open the journal for appending, once the lock is held and the journal loaded
+     * @return bool true = success, false = failure, see errno
+     */
+    bool startJournal() {
+        _journal = fopen(_path.c_str(), "a");
+        return _journal != nullptr;
+    }
+
+    bool isJournalOpen() const { return _journal != nullptr; }
+
+    /**
+     * Queue the line of one event, written by the next commit()
+     */
+    void queueFile(int64_t nextFrame, int32_t repeat, const std::string &name) {
+        appendLine(_queued, 'p', nextFrame, repeat, name);
+    }
+    void queueManifest(int64_t nextFrame, int32_t repeat, int64_t nextLine) {
+        appendLine(_queued, 'm', nextFrame, repeat, std::to_string(static_cast<long long>(nextLine)));
+    }
+    void queueFollowed(int64_t nextFrame, uint64_t inode, int64_t done, const std::string &name) {
+        appendFollowed(_queued, nextFrame, inode, done, name);
+    }
+
+    bool hasQueued() const { return !_queued.empty(); }
+
+    /**
+     * Append the queued lines to the journal and apply them to the state, flushed every
+     * interval lines, and compact the journal once it is mostly redundant
+     * @return bool true = success, false = write error
+     */
+    bool commit() {
+        if (_queued.empty() || _journal == nullptr) {
+            _queued.clear();
+            return true;
+        }
+        bool ok = fwrite(_queued.data(), 1, _queued.size(), _journal) == _queued.size();
+        int64_t before = _lines;
+        applyLines(_queued);
+        _queued.clear();
+        _pending += (int32_t)(_lines - before);
+        if (_pending >= _interval) {
+            ok = fflush(_journal) == 0 && ok;
+            _pending = 0;
+        }
+        // repeat passes write the same names again
+        if (_lines > 2 * (int64_t)(processed.size() + followed.size()) + 1024) {
+            ok = compact() && ok;
+        }
+        return ok;
+    }
+
+    /**
+     * Rewrite the journal with one line per processed or followed file, the resume position last
+     * @return bool true = success, false = the journal was not rewritten
+     */
+    bool compact() {
+        std::string tmpFile = _path + ".tmp";
+        FILE *file = fopen(tmpFile.c_str(), "w");
+        if (file == nullptr) {
+            return false;
+        }
+        int32_t repeat = repeatCount == INT32_MIN ? 0 : repeatCount;
+        std::string lines;
+        for (const std::string &name : processed) {
+            if (name != lastName) {
+                appendLine(lines, 'p', frameNumber, repeat, name);
+            }
+        }
+        for (const auto &pos : followed) {
+            appendFollowed(lines, frameNumber, pos.second.inode, pos.second.done, pos.first);
+        }
+        if (manifestLine >= 0) {
+            appendLine(lines, 'm', frameNumber, repeat, std::to_string(static_cast<long long>(manifestLine)));
+        } else if (frameNumber > 0) {
+            appendLine(lines, 'p', frameNumber, repeat, lastName);
+        }
+        bool ok = fwrite(lines.data(), 1, lines.size(), file) == lines.size();
+        if (fclose(file) != 0 || !ok || rename(tmpFile.c_str(), _path.c_str()) != 0) {
+            unlink(tmpFile.c_str());
+            return false;
+        }
+        _lines = 0;
+        for (char c : lines) {
+            _lines += c == '\n';
+        }
+        if (_journal) {
+            fclose(_journal);
+            _journal = fopen(_path.c_str(), "a");
+        }
+        _pending = 0;
+        return _journal != nullptr;
+    }
+
+    /**
+     * Close the journal and release the lock, a standby takes over
+     */
+    void close() {
+        if (_journal) {
+            fclose(_journal);
+            _journal = nullptr;
+        }
+        if (_lockFd >= 0) {
+            ::close(_lockFd);
+            _lockFd = -1;
+        }
+        _queued.clear();
+    }
+
+    int64_t lines() const { return _lines; }
+
+private:
+    static void appendLine(std::string &lines, char type, int64_t nextFrame, int32_t repeat, const std::string &last) {
+        lines += type;
+        lines += '\t';
+        lines += std::to_string(static_cast<long long>(nextFrame));
+        lines += '\t';
+        lines += std::to_string(static_cast<long long>(repeat));
+        lines += '\t';
+        lines += last;
+        lines += '\n';
+    }
+
+    static void appendFollowed(std::string &lines, int64_t nextFrame, uint64_t inode, int64_t done, const std::string &name) {
+        lines += "f\t";
+        lines += std::to_string(static_cast<long long>(nextFrame));
+        lines += '\t';
+        lines += std::to_string(static_cast<unsigned long long>(inode));
+        lines += '\t';
+        lines += std::to_string(static_cast<long long>(done));
+        lines += '\t';
+        lines += name;
+        lines += '\n';
+    }
+
+    /**
+     * Apply the complete lines of text
+     * @return size_t number of bytes applied, the rest is a partial line
+     */
+    size_t applyLines(const std::string &text) {
+        size_t begin = 0;
+        size_t end;
+        while ((end = text.find('\n', begin)) != std::string::npos) {
+            applyLine(text.c_str() + begin, text.c_str() + end);
+            begin = end + 1;
+        }
+        return begin;
+    }
+
+    void applyLine(const char *line, const char *end) {
+        if (end - line < 2 || line[1] != '\t') {
+            return;
+        }
+        char *field = nullptr;
+        int64_t nextFrame = strtoll(line + 2, &field, 10);
+        if (*field != '\t') {
+            return;
+        }
+        if (line[0] == 'f') {
+            uint64_t inode = strtoull(field + 1, &field, 10);
+            if (*field != '\t') {
+                return;
+            }
+            int64_t done = strtoll(field + 1, &field, 10);
+            if (*field != '\t' || field + 1 >= end) {
+                return;
+            }
+            dfESPbfileCheckpointPos_t &pos = followed[std::string(field + 1, end - field - 1)];
+            pos.inode = inode;
+            pos.done = done;
+        } else if (line[0] == 'p' || line[0] == 'm') {
+            int32_t repeat = (int32_t)strtol(field + 1, &field, 10);
+            if (*field != '\t') {
+                return;
+            }
+            field++;
+            if (line[0] == 'm') {
+                manifestLine = strtoll(field, &field, 10);
+            } else if (field < end) {
+                lastName.assign(field, end - field);
+                processed.insert(lastName);
+            }
+            repeatCount = repeat;
+        } else {
+            return;
+        }
+        frameNumber = nextFrame;
+        _lines++;
+    }
+
+    std::string _path;
+    int32_t     _interval   = 1;
+    int         _lockFd     = -1;
+    FILE       *_journal    = nullptr;
+    int64_t     _readOffset = 0;
+    ino_t       _inode      = 0;
+    std::string _partial;             // last journal line read, not complete yet
+    std::string _queued;              // lines of the events not injected yet
+    int64_t     _lines      = 0;      // lines in the journal, for the compaction
+    int32_t     _pending    = 0;      // lines written since the last flush
+};
+
+#endif
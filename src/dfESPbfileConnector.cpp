@@ -16,6 +16,21 @@
 #include "portFileIO.h"
 
 #include <regex>
+#include <thread>
+#include <cerrno>
+#include <climits>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/file.h>
+#include <sys/time.h>
+#if defined(OS_LINUX)
+#include <sys/inotify.h>
+#endif
+#include <unistd.h>
 
 #include "boost/algorithm/string/trim.hpp"
 
@@ -48,6 +63,16 @@ dfESPconnectorInfo *getConnectorInfo() {
 
 dfESPstring dfESPbfileConnector::bfileSubAnnotationsFormatValues[] = {"astore", "tracking"};
 dfESPstring dfESPbfileConnector::bfileSubAnnotationsCoordTypeValues[] = {"rect", "yolo", "coco"};
+dfESPstring dfESPbfileConnector::bfilePubReplayValues[] = {"none", "mtime", "filename"};
+dfESPstring dfESPbfileConnector::bfilePubReplayTsUnitValues[] = {"s", "ms", "us", "ns"};
+dfESPstring dfESPbfileConnector::bfileSubOutputValues[] = {"file", "shm"};
+dfESPstring dfESPbfileConnector::bfilePubSourceValues[] = {"dir", "fifo", "socket"};
+dfESPstring dfESPbfileConnector::bfilePubFreshnessValues[] = {"fifo", "lifo", "latest"};
+dfESPstring dfESPbfileConnector::bfilePubStaleActionValues[] = {"drop", "archive"};
+dfESPstring dfESPbfileConnector::bfilePubShardClaimValues[] = {"none", "excl", "rename"};
+dfESPstring dfESPbfileConnector::bfilePubProbeValues[] = {"none", "fill", "reject", "quarantine"};
+const char *dfESPbfileConnector::bfileTraceFieldNames[] = {"trace_mtime", "trace_readstart", "trace_readend", "trace_inject"};
+const char *dfESPbfileConnector::bfileProbeFieldNames[] = {"width", "height", "channels"};
 // dfESPstring dfESPbfileConnector::bfileSubFileTypeValues[] = {"jpg", "tif", "bmp"};
 
 //
@@ -59,8 +84,7 @@ dfESPconnectorParmInfo_t dfESPbfileConnector::pubRequiredConfig[] = {
     {"continuousquery", "", 0, NULL, true},
     {"window", "", 0, NULL, true},
 
-    {"path", "", 0, NULL, false},
-    {"filename_rgx", "", 0, NULL, false}
+    {"path", "", 0, NULL, false}
 };
 size_t dfESPbfileConnector::sizeofPubReqConfig =
     sizeof(dfESPbfileConnector::pubRequiredConfig)/sizeof(dfESPconnectorParmInfo_t);
@@ -71,8 +95,50 @@ dfESPconnectorParmInfo_t dfESPbfileConnector::pubOptionalConfig[] = {
     {"token", "", 0, NULL, true},
     {"tokenlocation", "", 0, NULL, true},
     
+    {"filename_rgx", "", 0, NULL, false},
+    {"recursive", "false", dfESPconnector::sizeofTrueFalseValues, dfESPconnector::trueFalseValues, false},
+    {"manifest", "", 0, NULL, false},
+    {"manifestoffset", "0", 0, NULL, false},
+    {"manifestbatch", "1000", 0, NULL, false},
+    {"pathweights", "", 0, NULL, false},
+    {"source", "dir", sizeof(bfilePubSourceValues)/sizeof(dfESPstring), bfilePubSourceValues, false},
+    {"freshness", "fifo", sizeof(bfilePubFreshnessValues)/sizeof(dfESPstring), bfilePubFreshnessValues, false},
+    {"maxage", "0", 0, NULL, false},
+    {"staleaction", "drop", sizeof(bfilePubStaleActionValues)/sizeof(dfESPstring), bfilePubStaleActionValues, false},
+    {"archivepath", "", 0, NULL, false},
+    {"shardcount", "1", 0, NULL, false},
+    {"shardid", "0", 0, NULL, false},
+    {"shardclaim", "none", sizeof(bfilePubShardClaimValues)/sizeof(dfESPstring), bfilePubShardClaimValues, false},
+    {"leasetimeout", "60000", 0, NULL, false},
+    {"probe", "none", sizeof(bfilePubProbeValues)/sizeof(dfESPstring), bfilePubProbeValues, false},
+    {"probewidth", "0", 0, NULL, false},
+    {"probeheight", "0", 0, NULL, false},
+    {"quarantinepath", "", 0, NULL, false},
+    {"probegrace", "10000", 0, NULL, false},
+    {"follow", "false", dfESPconnector::sizeofTrueFalseValues, dfESPconnector::trueFalseValues, false},
+    {"recorddelimiter", "", 0, NULL, false},
+    {"followchunk", "1048576", 0, NULL, false},
+    {"followpoll", "1000", 0, NULL, false},
+    {"recordname", "false", dfESPconnector::sizeofTrueFalseValues, dfESPconnector::trueFalseValues, false},
+    {"maxrecordsize", "67108864", 0, NULL, false},
+
     {"publishrate", "0", 0, NULL, false},
     {"repeatcount", "0", 0, NULL, false},
+
+    {"checkpointfile", "", 0, NULL, false},
+    {"checkpointinterval", "1", 0, NULL, false},
+
+    {"replay", "none", sizeof(bfilePubReplayValues)/sizeof(dfESPstring), bfilePubReplayValues, false},
+    {"replayspeed", "1", 0, NULL, false},
+    {"replaytsgroup", "1", 0, NULL, false},
+    {"replaytsunit", "ms", sizeof(bfilePubReplayTsUnitValues)/sizeof(dfESPstring), bfilePubReplayTsUnitValues, false},
+
+    {"adaptive", "false", dfESPconnector::sizeofTrueFalseValues, dfESPconnector::trueFalseValues, false},
+    {"adaptivelatency", "50", 0, NULL, false},
+    {"adaptiveminrate", "1", 0, NULL, false},
+    {"adaptivemaxrate", "1000", 0, NULL, false},
+    {"adaptiveratestep", "1", 0, NULL, false},
+    {"adaptivemaxblocksize", "64", 0, NULL, false},
     
     {"transactional", "false", dfESPconnector::sizeofTrueFalseValues, dfESPconnector::trueFalseValues, false},
     {"blocksize", "1", 0, NULL, false},
@@ -92,7 +158,6 @@ dfESPconnectorParmInfo_t dfESPbfileConnector::subRequiredConfig[] = {
     {"window", "", 0, NULL, true},
     {"snapshot", "true", dfESPconnector::sizeofTrueFalseValues, dfESPconnector::trueFalseValues, false},
     
-    {"filename", "", 0, NULL, false},
     {"datafieldname", "", 0, NULL, false}
 };
 size_t dfESPbfileConnector::sizeofSubReqConfig =
@@ -106,6 +171,17 @@ dfESPconnectorParmInfo_t dfESPbfileConnector::subOptionalConfig[] = {
 
     /*{"filetype", "jpg", sizeof(bfileSubFileTypeValues)/sizeof(dfESPstring), bfileSubFileTypeValues, false}, */
 
+    {"output", "file", sizeof(bfileSubOutputValues)/sizeof(dfESPstring), bfileSubOutputValues, false},
+    {"filename", "", 0, NULL, false},
+    {"shmname", "", 0, NULL, false},
+    {"shmslots", "64", 0, NULL, false},
+    {"shmslotsize", "4194304", 0, NULL, false},
+    {"tracefile", "", 0, NULL, false},
+    {"sampleevery", "1", 0, NULL, false},
+    {"maxeventrate", "0", 0, NULL, false},
+    {"maxbyterate", "0", 0, NULL, false},
+    {"keeplastinterval", "0", 0, NULL, false},
+
     {"collapse", "false", dfESPconnector::sizeofTrueFalseValues, dfESPconnector::trueFalseValues, false},
     {"rmretdel", "false", dfESPconnector::sizeofTrueFalseValues, dfESPconnector::trueFalseValues, false},
     {"dateformat", "", 0, NULL, false},
@@ -153,20 +229,131 @@ bool dfESPbfileConnector::start() {
         //
         // check SUBSCRIBER parameters
         //
-        _outputFileName = getParameter("filename");
+        _outputToShm = (getParameter("output") == "shm");
+
+        if (_outputToShm) {
+            //
+            // shmname, shmslots, shmslotsize
+            //
+            dfESPstring shmName = getParameter("shmname");
+            if ((shmName == "") ) {
+                _errorKey = "shmname";
+                _errorValue = "";
+                _errorReason = PARM_MISSING;
+                eLOG_ERROR("Connectors0005", (  "dfESPbfileConnector::start()","shmname" ) );
+                if (_errorCallback) {_errorCallback(ESP_PUBSUBFAIL_CONNECTORFAIL,ESP_PUBSUBCODE_NOERROR, _ctx); }
+                return false;
+            }
+            int32_t shmSlots = 0;
+            dfESPstring shmSlotsValue = getParameter("shmslots");
+            if (!dfESPconvUtils::ato32(shmSlotsValue.c_str(), &shmSlots) || shmSlots < 1) {
+                _errorKey = "shmslots";
+                _errorValue = shmSlotsValue.c_str();
+                _errorReason = INVALID_VALUE;
+                eLOG_ERROR("Connectors0008", ( "dfESPbfileConnector::start()", "shmslots", shmSlotsValue ) );
+                if (_errorCallback) { _errorCallback(ESP_PUBSUBFAIL_CONNECTORFAIL,ESP_PUBSUBCODE_NOERROR, _ctx); }
+                return false;
+            }
+            int64_t shmSlotSize = 0;
+            dfESPstring shmSlotSizeValue = getParameter("shmslotsize");
+            if (!dfESPconvUtils::ato64(shmSlotSizeValue.c_str(), &shmSlotSize) || shmSlotSize < 1) {
+                _errorKey = "shmslotsize";
+                _errorValue = shmSlotSizeValue.c_str();
+                _errorReason = INVALID_VALUE;
+                eLOG_ERROR("Connectors0008", ( "dfESPbfileConnector::start()", "shmslotsize", shmSlotSizeValue ) );
+                if (_errorCallback) { _errorCallback(ESP_PUBSUBFAIL_CONNECTORFAIL,ESP_PUBSUBCODE_NOERROR, _ctx); }
+                return false;
+            }
+            if (!_shmWriter.open(shmName.c_str(), (uint32_t)shmSlots, (uint64_t)shmSlotSize)) {
+                ostringstream oss;
+                oss << "ERROR: could not create shared memory ring: " << shmName << " " << strerror(errno);
+                eLOG_ERROR("Connectors0110", (  oss.str().c_str() ) ); 
+                if (_errorCallback) {_errorCallback(ESP_PUBSUBFAIL_CONNECTORFAIL,ESP_PUBSUBCODE_NOERROR, _ctx); }
+                return false;
+            }
+        } else {
+            _outputFileName = getParameter("filename");
+
+            if ((_outputFileName == "") ) {
+                _errorKey = "filename";
+                _errorValue = "";
+                _errorReason = PARM_MISSING;
+                eLOG_ERROR("Connectors0005", (  "dfESPbfileConnector::start()","filename" ) );
+                if (_errorCallback) {_errorCallback(ESP_PUBSUBFAIL_CONNECTORFAIL,ESP_PUBSUBCODE_NOERROR, _ctx); }
+                return false;
+            }
 
-        if ((_outputFileName == "") ) {
-            _errorKey = "filename";
-            _errorValue = "";
-            _errorReason = PARM_MISSING;
-            eLOG_ERROR("Connectors0005", (  "dfESPbfileConnector::start()","filename" ) );
-            if (_errorCallback) {_errorCallback(ESP_PUBSUBFAIL_CONNECTORFAIL,ESP_PUBSUBCODE_NOERROR, _ctx); }
-            return false;
+            _outputFilePath = _outputFileName.substr(0,_outputFileName.find_last_of('.')) ;
+            _outputFileExtension = _outputFileName.substr(_outputFileName.find_last_of('.') ); 
         }
 
-        _outputFilePath = _outputFileName.substr(0,_outputFileName.find_last_of('.')) ;
-        _outputFileExtension = _outputFileName.substr(_outputFileName.find_last_of('.') ); 
 
+        //
+        // tracefile
+        //
+        dfESPstring traceFile = getParameter("tracefile");
+        if (!traceFile.empty()) {
+            _traceFile = fopen(traceFile.c_str(), "w");
+            if (_traceFile == nullptr) {
+                _errorKey = "tracefile";
+                _errorValue = traceFile.c_str();
+                _errorReason = INVALID_VALUE;
+                eLOG_ERROR("Connectors0008", ( "dfESPbfileConnector::start()", "tracefile", traceFile ) );
+                if (_errorCallback) { _errorCallback(ESP_PUBSUBFAIL_CONNECTORFAIL,ESP_PUBSUBCODE_NOERROR, _ctx); }
+                return false;
+            }
+            fprintf(_traceFile, "id,mtime,readstart,readend,inject,receive,written\n");
+        }
+
+        //
+        // sampleevery, maxeventrate, maxbyterate, keeplastinterval
+        //
+        dfESPstring sampleEvery = getParameter("sampleevery");
+        if (!dfESPconvUtils::ato64(sampleEvery.c_str(), &_sampleEvery) || _sampleEvery < 1) {
+            _errorKey = "sampleevery";
+            _errorValue = sampleEvery.c_str();
+            _errorReason = INVALID_VALUE;
+            eLOG_ERROR("Connectors0008", ( "dfESPbfileConnector::start()", "sampleevery", sampleEvery ) );
+            if (_errorCallback) { _errorCallback(ESP_PUBSUBFAIL_CONNECTORFAIL,ESP_PUBSUBCODE_NOERROR, _ctx); }
+            return false;
+        }
+        dfESPstring maxEventRate = getParameter("maxeventrate");
+        try {
+            _maxEventRate = stod(string(maxEventRate.c_str()));
+        } catch (const std::exception &e) {
+            _maxEventRate = -1.0;
+        }
+        if (_maxEventRate < 0.0) {
+            _errorKey = "maxeventrate";
+            _errorValue = maxEventRate.c_str();
+            _errorReason = INVALID_VALUE;
+            eLOG_ERROR("Connectors0008", ( "dfESPbfileConnector::start()", "maxeventrate", maxEventRate ) );
+            if (_errorCallback) { _errorCallback(ESP_PUBSUBFAIL_CONNECTORFAIL,ESP_PUBSUBCODE_NOERROR, _ctx); }
+            return false;
+        }
+        dfESPstring maxByteRate = getParameter("maxbyterate");
+        if (!dfESPconvUtils::ato64(maxByteRate.c_str(), &_maxByteRate) || _maxByteRate < 0) {
+            _errorKey = "maxbyterate";
+            _errorValue = maxByteRate.c_str();
+            _errorReason = INVALID_VALUE;
+            eLOG_ERROR("Connectors0008", ( "dfESPbfileConnector::start()", "maxbyterate", maxByteRate ) );
+            if (_errorCallback) { _errorCallback(ESP_PUBSUBFAIL_CONNECTORFAIL,ESP_PUBSUBCODE_NOERROR, _ctx); }
+            return false;
+        }
+        dfESPstring keepLastInterval = getParameter("keeplastinterval");
+        if (!dfESPconvUtils::ato64(keepLastInterval.c_str(), &_keepLastInterval) || _keepLastInterval < 0) {
+            _errorKey = "keeplastinterval";
+            _errorValue = keepLastInterval.c_str();
+            _errorReason = INVALID_VALUE;
+            eLOG_ERROR("Connectors0008", ( "dfESPbfileConnector::start()", "keeplastinterval", keepLastInterval ) );
+            if (_errorCallback) { _errorCallback(ESP_PUBSUBFAIL_CONNECTORFAIL,ESP_PUBSUBCODE_NOERROR, _ctx); }
+            return false;
+        }
+        // buckets start full, one second worth of events and bytes
+        _eventTokens = _maxEventRate > 1.0 ? _maxEventRate : 1.0;
+        _byteTokens = (double)_maxByteRate;
+        _tokensRefill = std::chrono::steady_clock::now();
+        _samplingReportTime = _tokensRefill;
 
         if (!startSub()) {
             return false;
@@ -180,8 +367,9 @@ bool dfESPbfileConnector::start() {
         // path
         //
         _filePath = getParameter("path");
+        _manifestFile = getParameter("manifest");
 
-        if ((_filePath == "") ) {
+        if ((_filePath == "") && _manifestFile.empty() ) {
             _errorKey = "path";
             _errorValue = "";
             _errorReason = PARM_MISSING;
@@ -190,11 +378,34 @@ bool dfESPbfileConnector::start() {
             return false;
         }
         //
+        // source
+        //
+        dfESPstring source = getParameter("source");
+        if (source == "fifo") {
+            _source = source_FIFO;
+        } else if (source == "socket") {
+            _source = source_SOCKET;
+        } else {
+            _source = source_DIR;
+        }
+        if (_source != source_DIR) {
+            _recordName = (getParameter("recordname") == "true");
+            dfESPstring maxRecordSize = getParameter("maxrecordsize");
+            if (!dfESPconvUtils::ato64(maxRecordSize.c_str(), &_maxRecordSize) || _maxRecordSize < 1 || _maxRecordSize > UINT32_MAX) {
+                _errorKey = "maxrecordsize";
+                _errorValue = maxRecordSize.c_str();
+                _errorReason = INVALID_VALUE;
+                eLOG_ERROR("Connectors0008", ( "dfESPbfileConnector::start()", "maxrecordsize", maxRecordSize ) );
+                if (_errorCallback) { _errorCallback(ESP_PUBSUBFAIL_CONNECTORFAIL,ESP_PUBSUBCODE_NOERROR, _ctx); }
+                return false;
+            }
+        }
+        //
         // filename_rgx
         //
         _fileNameRgx = getParameter("filename_rgx");
 
-        if ((_fileNameRgx == "") ) {
+        if ((_fileNameRgx == "") && _source == source_DIR && _manifestFile.empty() ) {
             _errorKey = "filename_rgx";
             _errorValue = "";
             _errorReason = PARM_MISSING;
@@ -203,6 +414,244 @@ bool dfESPbfileConnector::start() {
             return false;
         }
         //
+        // manifestoffset, manifestbatch
+        //
+        if (!_manifestFile.empty()) {
+            dfESPstring manifestOffset = getParameter("manifestoffset");
+            if (!dfESPconvUtils::ato64(manifestOffset.c_str(), &_manifestLine) || _manifestLine < 0) {
+                _errorKey = "manifestoffset";
+                _errorValue = manifestOffset.c_str();
+                _errorReason = INVALID_VALUE;
+                eLOG_ERROR("Connectors0008", ( "dfESPbfileConnector::start()", "manifestoffset", manifestOffset ) );
+                if (_errorCallback) { _errorCallback(ESP_PUBSUBFAIL_CONNECTORFAIL,ESP_PUBSUBCODE_NOERROR, _ctx); }
+                return false;
+            }
+            _manifestDoneLine = _manifestLine;
+            dfESPstring manifestBatch = getParameter("manifestbatch");
+            if (!dfESPconvUtils::ato32(manifestBatch.c_str(), &_manifestBatch) || _manifestBatch < 1) {
+                _errorKey = "manifestbatch";
+                _errorValue = manifestBatch.c_str();
+                _errorReason = INVALID_VALUE;
+                eLOG_ERROR("Connectors0008", ( "dfESPbfileConnector::start()", "manifestbatch", manifestBatch ) );
+                if (_errorCallback) { _errorCallback(ESP_PUBSUBFAIL_CONNECTORFAIL,ESP_PUBSUBCODE_NOERROR, _ctx); }
+                return false;
+            }
+        }
+        //
+        // freshness, maxage, staleaction, archivepath
+        //
+        dfESPstring freshness = getParameter("freshness");
+        if (freshness == "lifo") {
+            _freshness = fresh_LIFO;
+        } else if (freshness == "latest") {
+            _freshness = fresh_LATEST;
+        } else {
+            _freshness = fresh_FIFO;
+        }
+        if (_source != source_DIR || !_manifestFile.empty() || getParameter("follow") == "true") {
+            _freshness = fresh_FIFO;
+        }
+        dfESPstring maxAge = getParameter("maxage");
+        if (!dfESPconvUtils::ato64(maxAge.c_str(), &_maxAge) || _maxAge < 0) {
+            _errorKey = "maxage";
+            _errorValue = maxAge.c_str();
+            _errorReason = INVALID_VALUE;
+            eLOG_ERROR("Connectors0008", ( "dfESPbfileConnector::start()", "maxage", maxAge ) );
+            if (_errorCallback) { _errorCallback(ESP_PUBSUBFAIL_CONNECTORFAIL,ESP_PUBSUBCODE_NOERROR, _ctx); }
+            return false;
+        }
+        _staleArchive = (getParameter("staleaction") == "archive");
+        _archivePath = getParameter("archivepath");
+        if (_staleArchive && _archivePath.empty()) {
+            _errorKey = "archivepath";
+            _errorValue = "";
+            _errorReason = PARM_MISSING;
+            eLOG_ERROR("Connectors0005", (  "dfESPbfileConnector::start()","archivepath" ) );
+            if (_errorCallback) {_errorCallback(ESP_PUBSUBFAIL_CONNECTORFAIL,ESP_PUBSUBCODE_NOERROR, _ctx); }
+            return false;
+        }
+        //
+        // shardcount, shardid, shardclaim, leasetimeout
+        //
+        dfESPstring shardCount = getParameter("shardcount");
+        if (!dfESPconvUtils::ato32(shardCount.c_str(), &_shard.count) || _shard.count < 1) {
+            _errorKey = "shardcount";
+            _errorValue = shardCount.c_str();
+            _errorReason = INVALID_VALUE;
+            eLOG_ERROR("Connectors0008", ( "dfESPbfileConnector::start()", "shardcount", shardCount ) );
+            if (_errorCallback) { _errorCallback(ESP_PUBSUBFAIL_CONNECTORFAIL,ESP_PUBSUBCODE_NOERROR, _ctx); }
+            return false;
+        }
+        dfESPstring shardId = getParameter("shardid");
+        if (!dfESPconvUtils::ato32(shardId.c_str(), &_shard.id) || _shard.id < 0 || _shard.id >= _shard.count) {
+            _errorKey = "shardid";
+            _errorValue = shardId.c_str();
+            _errorReason = INVALID_VALUE;
+            eLOG_ERROR("Connectors0008", ( "dfESPbfileConnector::start()", "shardid", shardId ) );
+            if (_errorCallback) { _errorCallback(ESP_PUBSUBFAIL_CONNECTORFAIL,ESP_PUBSUBCODE_NOERROR, _ctx); }
+            return false;
+        }
+        dfESPstring shardClaim = getParameter("shardclaim");
+        if (shardClaim == "excl") {
+            _shard.mode = dfESPbfileShard::mode_EXCL;
+        } else if (shardClaim == "rename") {
+            _shard.mode = dfESPbfileShard::mode_RENAME;
+        } else {
+            _shard.mode = dfESPbfileShard::mode_NONE;
+        }
+        if (_source != source_DIR || getParameter("follow") == "true") {
+            // followed files are read in place, and streams are not shared
+            _shard.mode = dfESPbfileShard::mode_NONE;
+        }
+        dfESPstring leaseTimeout = getParameter("leasetimeout");
+        if (!dfESPconvUtils::ato64(leaseTimeout.c_str(), &_shard.leaseTimeoutMs) || _shard.leaseTimeoutMs < 1) {
+            _errorKey = "leasetimeout";
+            _errorValue = leaseTimeout.c_str();
+            _errorReason = INVALID_VALUE;
+            eLOG_ERROR("Connectors0008", ( "dfESPbfileConnector::start()", "leasetimeout", leaseTimeout ) );
+            if (_errorCallback) { _errorCallback(ESP_PUBSUBFAIL_CONNECTORFAIL,ESP_PUBSUBCODE_NOERROR, _ctx); }
+            return false;
+        }
+        if (_shard.mode != dfESPbfileShard::mode_NONE) {
+            char hostName[256] = "";
+            gethostname(hostName, sizeof(hostName) - 1);
+            _shard.node = std::string(hostName) + "-" + to_string(static_cast<long long>(getpid()));
+        }
+        //
+        // probe, probewidth, probeheight, quarantinepath
+        //
+        dfESPstring probe = getParameter("probe");
+        if (probe == "fill") {
+            _probe = probe_FILL;
+        } else if (probe == "reject") {
+            _probe = probe_REJECT;
+        } else if (probe == "quarantine") {
+            _probe = probe_QUARANTINE;
+        } else {
+            _probe = probe_NONE;
+        }
+        dfESPstring probeWidth = getParameter("probewidth");
+        if (!dfESPconvUtils::ato32(probeWidth.c_str(), &_probeWidth) || _probeWidth < 0) {
+            _errorKey = "probewidth";
+            _errorValue = probeWidth.c_str();
+            _errorReason = INVALID_VALUE;
+            eLOG_ERROR("Connectors0008", ( "dfESPbfileConnector::start()", "probewidth", probeWidth ) );
+            if (_errorCallback) { _errorCallback(ESP_PUBSUBFAIL_CONNECTORFAIL,ESP_PUBSUBCODE_NOERROR, _ctx); }
+            return false;
+        }
+        dfESPstring probeHeight = getParameter("probeheight");
+        if (!dfESPconvUtils::ato32(probeHeight.c_str(), &_probeHeight) || _probeHeight < 0) {
+            _errorKey = "probeheight";
+            _errorValue = probeHeight.c_str();
+            _errorReason = INVALID_VALUE;
+            eLOG_ERROR("Connectors0008", ( "dfESPbfileConnector::start()", "probeheight", probeHeight ) );
+            if (_errorCallback) { _errorCallback(ESP_PUBSUBFAIL_CONNECTORFAIL,ESP_PUBSUBCODE_NOERROR, _ctx); }
+            return false;
+        }
+        dfESPstring probeGrace = getParameter("probegrace");
+        if (!dfESPconvUtils::ato64(probeGrace.c_str(), &_probeGrace) || _probeGrace < 0) {
+            _errorKey = "probegrace";
+            _errorValue = probeGrace.c_str();
+            _errorReason = INVALID_VALUE;
+            eLOG_ERROR("Connectors0008", ( "dfESPbfileConnector::start()", "probegrace", probeGrace ) );
+            if (_errorCallback) { _errorCallback(ESP_PUBSUBFAIL_CONNECTORFAIL,ESP_PUBSUBCODE_NOERROR, _ctx); }
+            return false;
+        }
+        _quarantinePath = getParameter("quarantinepath");
+        if (_probe == probe_QUARANTINE && _quarantinePath.empty()) {
+            _errorKey = "quarantinepath";
+            _errorValue = "";
+            _errorReason = PARM_MISSING;
+            eLOG_ERROR("Connectors0005", (  "dfESPbfileConnector::start()","quarantinepath" ) );
+            if (_errorCallback) {_errorCallback(ESP_PUBSUBFAIL_CONNECTORFAIL,ESP_PUBSUBCODE_NOERROR, _ctx); }
+            return false;
+        }
+        //
+        // follow, recorddelimiter, followchunk, followpoll
+        //
+        _follow = (getParameter("follow") == "true") && _source == source_DIR && _manifestFile.empty();
+        if (_follow) {
+            //
+            // the delimiter may use the \n, \r, \t and \0 escapes
+            //
+            std::string delimiter = getParameter("recorddelimiter").c_str();
+            _recordDelimiter.clear();
+            for (size_t c = 0; c < delimiter.size(); c++) {
+                if (delimiter[c] == '\\' && c + 1 < delimiter.size()) {
+                    c++;
+                    switch (delimiter[c]) {
+                    case 'n': _recordDelimiter += '\n'; break;
+                    case 'r': _recordDelimiter += '\r'; break;
+                    case 't': _recordDelimiter += '\t'; break;
+                    case '0': _recordDelimiter += '\0'; break;
+                    default:  _recordDelimiter += delimiter[c]; break;
+                    }
+                } else {
+                    _recordDelimiter += delimiter[c];
+                }
+            }
+            dfESPstring followChunk = getParameter("followchunk");
+            if (!dfESPconvUtils::ato64(followChunk.c_str(), &_followChunk) || _followChunk < 1) {
+                _errorKey = "followchunk";
+                _errorValue = followChunk.c_str();
+                _errorReason = INVALID_VALUE;
+                eLOG_ERROR("Connectors0008", ( "dfESPbfileConnector::start()", "followchunk", followChunk ) );
+                if (_errorCallback) { _errorCallback(ESP_PUBSUBFAIL_CONNECTORFAIL,ESP_PUBSUBCODE_NOERROR, _ctx); }
+                return false;
+            }
+            dfESPstring followPoll = getParameter("followpoll");
+            if (!dfESPconvUtils::ato32(followPoll.c_str(), &_followPoll) || _followPoll < 1) {
+                _errorKey = "followpoll";
+                _errorValue = followPoll.c_str();
+                _errorReason = INVALID_VALUE;
+                eLOG_ERROR("Connectors0008", ( "dfESPbfileConnector::start()", "followpoll", followPoll ) );
+                if (_errorCallback) { _errorCallback(ESP_PUBSUBFAIL_CONNECTORFAIL,ESP_PUBSUBCODE_NOERROR, _ctx); }
+                return false;
+            }
+        }
+        //
+        // path list, recursive, pathweights
+        //
+        if (_source == source_DIR && _manifestFile.empty()) {
+            _recursive = (getParameter("recursive") == "true");
+            _roots.clear();
+            std::string paths = _filePath.c_str();
+            size_t begin = 0;
+            while (begin <= paths.size()) {
+                size_t end = paths.find(';', begin);
+                if (end == std::string::npos) {
+                    end = paths.size();
+                }
+                std::string root = paths.substr(begin, end - begin);
+                boost::algorithm::trim(root);
+                while (root.size() > 1 && root[root.size() - 1] == '/') {
+                    root.erase(root.size() - 1);
+                }
+                if (!root.empty()) {
+                    bfileSourceDir_t sourceDir;
+                    sourceDir.path = root;
+                    _roots.push_back(sourceDir);
+                }
+                begin = end + 1;
+            }
+            dfESPstring pathWeights = getParameter("pathweights");
+            std::istringstream weights(pathWeights.c_str());
+            std::string weight;
+            size_t r = 0;
+            while (std::getline(weights, weight, ',')) {
+                boost::algorithm::trim(weight);
+                if (r >= _roots.size() || !dfESPconvUtils::ato32(weight.c_str(), &_roots[r].weight) || _roots[r].weight < 1) {
+                    _errorKey = "pathweights";
+                    _errorValue = pathWeights.c_str();
+                    _errorReason = INVALID_VALUE;
+                    eLOG_ERROR("Connectors0008", ( "dfESPbfileConnector::start()", "pathweights", pathWeights ) );
+                    if (_errorCallback) { _errorCallback(ESP_PUBSUBFAIL_CONNECTORFAIL,ESP_PUBSUBCODE_NOERROR, _ctx); }
+                    return false;
+                }
+                r++;
+            }
+        }
+        //
         // publishrate
         //
          dfESPstring value = getParameter("publishrate");
@@ -219,6 +668,151 @@ bool dfESPbfileConnector::start() {
             if (_errorCallback) { _errorCallback(ESP_PUBSUBFAIL_CONNECTORFAIL,ESP_PUBSUBCODE_NOERROR, _ctx); }
             return false;
         }
+        if (_repeatCount > 0 && _shard.mode != dfESPbfileShard::mode_NONE) {
+            // a claimed file is published once by one of the instances, never again by a repeat pass
+            _errorKey = "repeatcount";
+            _errorValue = repeatCount.c_str();
+            _errorReason = INVALID_VALUE;
+            eLOG_ERROR("Connectors0008", ( "dfESPbfileConnector::start()", "repeatcount", repeatCount ) );
+            if (_errorCallback) { _errorCallback(ESP_PUBSUBFAIL_CONNECTORFAIL,ESP_PUBSUBCODE_NOERROR, _ctx); }
+            return false;
+        }
+        //
+        // checkpointfile, checkpointinterval
+        //
+        _checkpointFile = getParameter("checkpointfile");
+        dfESPstring checkpointInterval = getParameter("checkpointinterval");
+        if (!dfESPconvUtils::ato32(checkpointInterval.c_str(), &_checkpointInterval) || _checkpointInterval < 1) {
+            _errorKey = "checkpointinterval";
+            _errorValue = checkpointInterval.c_str();
+            _errorReason = INVALID_VALUE;
+            eLOG_ERROR("Connectors0008", ( "dfESPbfileConnector::start()", "checkpointinterval", checkpointInterval ) );
+            if (_errorCallback) { _errorCallback(ESP_PUBSUBFAIL_CONNECTORFAIL,ESP_PUBSUBCODE_NOERROR, _ctx); }
+            return false;
+        }
+        //
+        // replay
+        //
+        dfESPstring replay = getParameter("replay");
+        if (replay == "mtime") {
+            _replayMode = replay_MTIME;
+        } else if (replay == "filename") {
+            _replayMode = replay_FILENAME;
+        } else {
+            _replayMode = replay_NONE;
+        }
+        //
+        // replayspeed
+        //
+        dfESPstring replaySpeed = getParameter("replayspeed");
+        try {
+            _replaySpeed = stod(string(replaySpeed.c_str()));
+        } catch (const std::exception &e) {
+            _errorKey = "replayspeed";
+            _errorValue = replaySpeed.c_str();
+            _errorReason = INVALID_VALUE;
+            eLOG_ERROR("Connectors0008", ( "dfESPbfileConnector::start()", "replayspeed", replaySpeed ) );
+            if (_errorCallback) { _errorCallback(ESP_PUBSUBFAIL_CONNECTORFAIL,ESP_PUBSUBCODE_NOERROR, _ctx); }
+            return false;
+        }
+        //
+        // replaytsgroup
+        //
+        dfESPstring replayTsGroup = getParameter("replaytsgroup");
+        if (!dfESPconvUtils::ato32(replayTsGroup.c_str(), &_replayTsGroup) || _replayTsGroup < 0) {
+            _errorKey = "replaytsgroup";
+            _errorValue = replayTsGroup.c_str();
+            _errorReason = INVALID_VALUE;
+            eLOG_ERROR("Connectors0008", ( "dfESPbfileConnector::start()", "replaytsgroup", replayTsGroup ) );
+            if (_errorCallback) { _errorCallback(ESP_PUBSUBFAIL_CONNECTORFAIL,ESP_PUBSUBCODE_NOERROR, _ctx); }
+            return false;
+        }
+        if (_replayMode == replay_FILENAME) {
+            //
+            // the group must exist in filename_rgx, else every file would be published without delay
+            //
+            size_t groupCount = 0;
+            bool rgxOk = !_fileNameRgx.empty();
+            try {
+                if (rgxOk) {
+                    std::regex rgx(_fileNameRgx.c_str());
+                    groupCount = rgx.mark_count();
+                }
+            } catch (const std::regex_error &e) {
+                rgxOk = false;
+            }
+            if (!rgxOk) {
+                _errorKey = "filename_rgx";
+                _errorValue = _fileNameRgx.c_str();
+                _errorReason = _fileNameRgx.empty() ? PARM_MISSING : INVALID_VALUE;
+                eLOG_ERROR("Connectors0008", ( "dfESPbfileConnector::start()", "filename_rgx", _fileNameRgx ) );
+                if (_errorCallback) { _errorCallback(ESP_PUBSUBFAIL_CONNECTORFAIL,ESP_PUBSUBCODE_NOERROR, _ctx); }
+                return false;
+            }
+            if ((size_t)_replayTsGroup > groupCount) {
+                _errorKey = "replaytsgroup";
+                _errorValue = replayTsGroup.c_str();
+                _errorReason = INVALID_VALUE;
+                eLOG_ERROR("Connectors0008", ( "dfESPbfileConnector::start()", "replaytsgroup", replayTsGroup ) );
+                if (_errorCallback) { _errorCallback(ESP_PUBSUBFAIL_CONNECTORFAIL,ESP_PUBSUBCODE_NOERROR, _ctx); }
+                return false;
+            }
+        }
+        //
+        // replaytsunit
+        //
+        dfESPstring replayTsUnit = getParameter("replaytsunit");
+        if (replayTsUnit == "s") {
+            _replayTsNsPerUnit = 1000000000;
+        } else if (replayTsUnit == "us") {
+            _replayTsNsPerUnit = 1000;
+        } else if (replayTsUnit == "ns") {
+            _replayTsNsPerUnit = 1;
+        } else {
+            _replayTsNsPerUnit = 1000000;
+        }
+        //
+        // adaptive
+        //
+        _adaptive = (getParameter("adaptive") == "true");
+        if (_adaptive) {
+            const char *adaptiveDoubleParms[] = {"adaptivelatency", "adaptiveminrate", "adaptivemaxrate", "adaptiveratestep"};
+            double *adaptiveDoubleValues[] = {&_adaptiveLatencyMs, &_adaptiveMinRate, &_adaptiveMaxRate, &_adaptiveRateStep};
+            for (size_t p = 0; p < sizeof(adaptiveDoubleParms)/sizeof(adaptiveDoubleParms[0]); p++) {
+                dfESPstring adaptiveValue = getParameter(adaptiveDoubleParms[p]);
+                bool ok = true;
+                try {
+                    *adaptiveDoubleValues[p] = stod(string(adaptiveValue.c_str()));
+                } catch (const std::exception &e) {
+                    ok = false;
+                }
+                if (!ok || *adaptiveDoubleValues[p] <= 0.0) {
+                    _errorKey = adaptiveDoubleParms[p];
+                    _errorValue = adaptiveValue.c_str();
+                    _errorReason = INVALID_VALUE;
+                    eLOG_ERROR("Connectors0008", ( "dfESPbfileConnector::start()", adaptiveDoubleParms[p], adaptiveValue ) );
+                    if (_errorCallback) { _errorCallback(ESP_PUBSUBFAIL_CONNECTORFAIL,ESP_PUBSUBCODE_NOERROR, _ctx); }
+                    return false;
+                }
+            }
+            if (_adaptiveMinRate > _adaptiveMaxRate) {
+                _errorKey = "adaptiveminrate";
+                _errorValue = getParameter("adaptiveminrate").c_str();
+                _errorReason = INVALID_VALUE;
+                eLOG_ERROR("Connectors0008", ( "dfESPbfileConnector::start()", "adaptiveminrate", getParameter("adaptiveminrate") ) );
+                if (_errorCallback) { _errorCallback(ESP_PUBSUBFAIL_CONNECTORFAIL,ESP_PUBSUBCODE_NOERROR, _ctx); }
+                return false;
+            }
+            dfESPstring adaptiveMaxBlocksize = getParameter("adaptivemaxblocksize");
+            if (!dfESPconvUtils::ato32(adaptiveMaxBlocksize.c_str(), &_adaptiveMaxBlocksize) || _adaptiveMaxBlocksize < 1) {
+                _errorKey = "adaptivemaxblocksize";
+                _errorValue = adaptiveMaxBlocksize.c_str();
+                _errorReason = INVALID_VALUE;
+                eLOG_ERROR("Connectors0008", ( "dfESPbfileConnector::start()", "adaptivemaxblocksize", adaptiveMaxBlocksize ) );
+                if (_errorCallback) { _errorCallback(ESP_PUBSUBFAIL_CONNECTORFAIL,ESP_PUBSUBCODE_NOERROR, _ctx); }
+                return false;
+            }
+        }
   
         if (!startPub()) {
             return false;
@@ -237,7 +831,6 @@ bool dfESPbfileConnector::setupCallbackFunction(dfESPschema *schema, bool winIsA
     _schema = schema;
     _winIsAutogen = winIsAutogen;
     dfESPstring *names = _schema->getNames();
-    dfESPdatavar::dfESPdatatype *types = _schema->getTypes();
     
     bool schemaOk = true;
     if (_type == type_PUB) {
@@ -254,18 +847,40 @@ bool dfESPbfileConnector::setupCallbackFunction(dfESPschema *schema, bool winIsA
                 schemaOk = false;  
             }
         } 
-        if (_schema->getNumFields() == 3) {
-            if (_schema->getTypeEO(2) != dfESPdatavar::ESP_UTF8STR) {
+        //
+        // the 3rd field is the file name, unless it is one of the optional fields recognized by name
+        //
+        for (int f = 2; f < _schema->getNumFields(); f++) {
+            int32_t trace = -1;
+            for (int32_t t = 0; t < trace_COUNT; t++) {
+                if (names[f] == bfileTraceFieldNames[t]) {
+                    trace = t;
+                }
+            }
+            int32_t probe = -1;
+            for (int32_t p = 0; p < probe_FIELDCOUNT; p++) {
+                if (names[f] == bfileProbeFieldNames[p]) {
+                    probe = p;
+                }
+            }
+            if (trace >= 0 && _schema->getTypeEO(f) == dfESPdatavar::ESP_INT64) {
+                _traceFieldIdx[trace] = f;
+            } else if (probe >= 0 && (_schema->getTypeEO(f) == dfESPdatavar::ESP_INT32 || _schema->getTypeEO(f) == dfESPdatavar::ESP_INT64)) {
+                _probeFieldIdx[probe] = f;
+            } else if (names[f] == "format" && _schema->getTypeEO(f) == dfESPdatavar::ESP_UTF8STR) {
+                _formatFieldIdx = f;
+            } else if (names[f] == "metadata" && _schema->getTypeEO(f) == dfESPdatavar::ESP_UTF8STR) {
+                _metadataFieldIdx = f;
+            } else if (f == 2 && _schema->getTypeEO(f) == dfESPdatavar::ESP_UTF8STR) {
+                _fileNameFieldIdx = f;
+            } else {
                 schemaOk = false;  
-            }   
-        } 
-        if (_schema->getNumFields() > 3) {
-            schemaOk = false;  
+            }
         }
 
         if (schemaOk == false ){
             eLOG_ERROR("Connectors0110", 
-                      ( "Source window schema must have 2 or 3 fields of type int64/blob or int64/string or int64/rstring or int64/blob/string or int64/string/string or int64/rstring/string" ) );
+                      ( "Source window schema must have 2 or 3 fields of type int64/blob or int64/string or int64/rstring or int64/blob/string or int64/string/string or int64/rstring/string, followed by optional string metadata and format, int32 or int64 width, height, channels and int64 trace_mtime, trace_readstart, trace_readend, trace_inject fields" ) );
             if (_errorCallback) { _errorCallback(ESP_PUBSUBFAIL_CONNECTORFAIL, ESP_PUBSUBCODE_NOERROR, _ctx); }
             return false;
         }
@@ -273,6 +888,10 @@ bool dfESPbfileConnector::setupCallbackFunction(dfESPschema *schema, bool winIsA
         if (_schema->getTypeEO(1) == dfESPdatavar::ESP_BINARY) {
             _publishAsBinary = true;
         }
+        // the probe fields are filled whenever the schema has them
+        if (_probe == probe_NONE && (_formatFieldIdx >= 0 || _probeFieldIdx[0] >= 0 || _probeFieldIdx[1] >= 0 || _probeFieldIdx[2] >= 0)) {
+            _probe = probe_FILL;
+        }
 
 
     } else if (_type == type_SUB) { 
@@ -301,6 +920,18 @@ bool dfESPbfileConnector::setupCallbackFunction(dfESPschema *schema, bool winIsA
             if (_errorCallback) { _errorCallback(ESP_PUBSUBFAIL_CONNECTORFAIL, ESP_PUBSUBCODE_NOERROR, _ctx) ;}
             return false;
         }
+
+        if (_traceFile) {
+            //
+            // trace fields stamped by the publisher, carried through the model
+            //
+            for (int32_t t = 0; t < trace_COUNT; t++) {
+                _traceFieldIdx[t] = _schema->findIndexIO(bfileTraceFieldNames[t]);
+                if (_traceFieldIdx[t] >= 0 && _schema->getTypeIO(_traceFieldIdx[t]) != dfESPdatavar::ESP_INT64) {
+                    _traceFieldIdx[t] = -1;
+                }
+            }
+        }
         
 
     } 
@@ -322,6 +953,9 @@ void dfESPbfileConnector::errorCallbackFunction(dfESPpubsubFailures_t failure,
 
 dfESPbfileConnector::dfESPbfileConnector(dfESPengine *engine, dfESPpsLib_t psLib,
                                    dfESPstring name, dfESPstring xportCfgFile) {
+    _traceWallUs0 = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    _traceMono0 = std::chrono::steady_clock::now();
+
     // init(psLib, engine, name, xportCfgFile);
     if (!init(psLib, engine, name, xportCfgFile)) {
         return;
@@ -353,7 +987,23 @@ dfESPbfileConnector::~dfESPbfileConnector() {
 void dfESPbfileConnector::freeResources() {
       
     if (_type == type_PUB) {
-  
+        // closing the lock descriptor releases the lock, a standby takes over
+        _checkpoint.close();
+        for (auto &followed : _followedFiles) {
+            ::close(followed.second.fd);
+        }
+        _followedFiles.clear();
+        if (_readBuff) {
+            free(_readBuff);
+            _readBuff = nullptr;
+            _readBuffSize = 0;
+        }
+    } else if (_type == type_SUB) {
+        _shmWriter.close();
+        if (_traceFile) {
+            fclose(_traceFile);
+            _traceFile = nullptr;
+        }
     }
 }
 
@@ -364,9 +1014,21 @@ bool dfESPbfileConnector::stop() {
         delete _pubThread;
         _pubThread = NULL;
         // checkCommit(0);
+        if (_schema) {
+            // events of a partial block
+            injectPending();
+        }
+        reportDropped(true);
     }
     dfESPconnector::stop();
     _schema = NULL;
+    if (_type == type_SUB) {
+        // no more callbacks, the last event of the current keeplastinterval is written now
+        if (_held.pending) {
+            writeHeld();
+        }
+        reportSampling(true);
+    }
     freeResources();
 
 #if DEBUG_PUBSUBCLIENT
@@ -400,6 +1062,17 @@ bool dfESPbfileConnector::startPub() {
         return false;
     }
 
+    if (_adaptive) {
+        // the configured blocksize is the lower bound of the adaptive block size
+        _adaptiveMinBlocksize = _blocksize > 0 ? _blocksize : 1;
+        if (_adaptiveMaxBlocksize < _adaptiveMinBlocksize) {
+            _adaptiveMaxBlocksize = _adaptiveMinBlocksize;
+        }
+    }
+
+    // the event vector never grows on the hot path
+    _trans.reserve(_adaptive ? _adaptiveMaxBlocksize : (_blocksize > 0 ? _blocksize : 1));
+
     // connect to ESP server
     if (!dfESPconnector::start()) {
         return false;
@@ -446,12 +1119,11 @@ bool dfESPbfileConnector::getFileList() {
     //
     // Get the file list
     //
-    port::Dir::PDIR_DIR *dir;
-    std::string dot="."; 
-    std::string dotdot=".."; 
     std::regex rgx; 
     try {
-        rgx = _fileNameRgx.c_str();
+        if (!_fileNameRgx.empty()) {
+            rgx = _fileNameRgx.c_str();
+        }
     } catch (const std::regex_error& e) {
         ostringstream oss;
         oss << "Bad filename_rgx regex: " << _fileNameRgx.c_str() << " "<< e.what() ;
@@ -473,156 +1145,1501 @@ bool dfESPbfileConnector::getFileList() {
         return false;
     }
     
-    dir = port::Dir::opendir(_filePath.c_str());
-    if (!dir) {
-        ostringstream oss;
-        oss << "ERROR: could not open directory: " << _filePath ;
-        eLOG_ERROR("Connectors0110", (  oss.str().c_str() ) ); 
-        return false;
-    } else {
-        port::Dir::PDIR_dirent *ent = port::Dir::readdir(dir);
-        while (ent) {
-            std::string fileName = port::Dir::get_name(ent);
-            if ((fileName.compare(dot) != 0) && (fileName.compare(dotdot) != 0)) {
-                if ( !port::Dir::is_dir(ent, _filePath.c_str()) && regex_match(fileName, rgx ) ) { 
-                    fileName = _filePath.c_str() + std::string("/") + fileName; 
-                    if (_processedFileList.find(fileName) == _processedFileList.end()) {
-                        _workingFileList.push_back(fileName);
-                    }
-                    
+    if (!_manifestFile.empty()) {
+        return readManifestBatch(rgx);
+    }
+
+    //
+    // scan each root, and its subdirectories when recursive, each directory being a source of its own
+    //
+    size_t kept = _workingFileList.size();
+    for (size_t r = 0; r < _roots.size(); r++) {
+        std::vector<std::string> dirs(1, _roots[r].path);
+        while (!dirs.empty()) {
+            std::string dirPath = dirs.back();
+            dirs.pop_back();
+            if (!scanDirectory(dirPath, _roots[r].weight, rgx, _recursive ? &dirs : nullptr)) {
+                if (dirPath == _roots[r].path) {
+                    return false;
                 }
+                // a subdirectory may have been removed since it was listed
             }
-            ent = port::Dir::readdir(dir);
         }
-        port::Dir::closedir(dir);
     }
-    //
-    // sort file list
-    //
-    std::sort (_workingFileList.begin(),_workingFileList.end());
+    if (kept > 0 && _workingFileList.size() > kept) {
+        //
+        // the list is kept across passes: a file of the previous pass that was not processed
+        // (unreadable, or still truncated when the thread stopped) is listed again, keep the new entry only
+        //
+        std::set<std::string> listed;
+        for (size_t j = _workingFileList.size(); j-- > 0; ) {
+            if (!listed.insert(_workingFileList[j].name).second) {
+                _workingFileList[j].name.clear();
+            }
+        }
+        _workingFileList.erase(std::remove_if(_workingFileList.begin(), _workingFileList.end(), [](const bfileEntry_t &entry) {
+            return entry.name.empty();
+        }), _workingFileList.end());
+    }
+    scheduleFileList();
+
     // //debug
     // for (size_t i= 0 ; i< _workingFileList.size(); i++) {
-    //     cout << "FILE: " << _workingFileList[i] << endl;
+    //     cout << "FILE: " << _workingFileList[i].name << endl;
     // }
 
     return true;
 }
 
+bool dfESPbfileConnector::scanDirectory(const std::string &dirPath, int32_t weight, const std::regex &rgx, std::vector<std::string> *subDirs) {
+    port::Dir::PDIR_DIR *dir;
+    std::string dot="."; 
+    std::string dotdot=".."; 
 
-void dfESPbfileConnector::publisherThread() {
-
-    dfESPptrVect<dfESPeventPtr> trans;
-    _schema->buildEventDatavarVect(_dvv);
-
-    int64_t frameNumber = 1;
-
-    bool error = false;
-
-    if ( _publishRate <= 0.0) {
-        _publishPeriod = 0;
+    dir = port::Dir::opendir(dirPath.c_str());
+    if (!dir) {
+        ostringstream oss;
+        oss << "ERROR: could not open directory: " << dirPath ;
+        eLOG_ERROR("Connectors0110", (  oss.str().c_str() ) ); 
+        return false;
+    }
+    //
+    // sources are numbered once, in discovery order, so that the round robin order is stable across scans
+    //
+    size_t source;
+    auto found = _sourceIndex.find(dirPath);
+    if (found == _sourceIndex.end()) {
+        source = _sourceDirs.size();
+        _sourceIndex[dirPath] = source;
+        bfileSourceDir_t sourceDir;
+        sourceDir.path = dirPath;
+        sourceDir.weight = weight;
+        _sourceDirs.push_back(sourceDir);
     } else {
-        _publishPeriod = static_cast<int32_t>(1000/_publishRate);
+        source = found->second;
     }
-        
-    auto lastTime = std::chrono::system_clock::now();
 
-    while(true) {
-        //
-        // Get the file list to read
-        //
-        if (!getFileList()) {
-            eLOG_ERROR("Connectors0110", (  "Error getting file list" ) ); 
-            error = true;
-            break;
-        }
-        ostringstream oss;
-        oss << "dfESPbfileConnector::publisherThread(): "<< "publishing " << _workingFileList.size() << " files as " << (_publishAsBinary? "binary":"string") << " fields" ;
-        eLOG_INFO("Connectors0110", (  oss.str().c_str() ) ); 
-        
-        size_t i = 0;
-        
-        while ( i < _workingFileList.size() && 0 == _threadStop.get() ) {
-            
-            auto now = std::chrono::system_clock::now();
+    port::Dir::PDIR_dirent *ent = port::Dir::readdir(dir);
+    std::smatch match;
+    // full path buffer reused for every entry, only the file name part changes
+    std::string fullName = dirPath + std::string("/");
+    const size_t dirLength = fullName.size();
+    while (ent) {
+        std::string fileName = port::Dir::get_name(ent);
+        if ((fileName.compare(dot) != 0) && (fileName.compare(dotdot) != 0)) {
+            if (port::Dir::is_dir(ent, dirPath.c_str())) {
+                if (subDirs) {
+                    subDirs->push_back(dirPath + "/" + fileName);
+                }
+            } else {
+                //
+                // claim files are never published, but the file of an expired lease is claimed again
+                //
+                std::string leasePath;
+                if (!_shard.sortEntry(dirPath, fileName, leasePath) || !_shard.owns(fileName) || !regex_match(fileName, match, rgx)) {
+                    ent = port::Dir::readdir(dir);
+                    continue;
+                }
+                fullName.resize(dirLength);
+                fullName += fileName;
+                // after a promotion, the files already published are listed again to find the resume position,
+                // an expired lease is listed even when its claim was lost before
+                if (_resumeFromCheckpoint || !leasePath.empty() || _processedFileList.find(fullName) == _processedFileList.end()) {
+                    bfileEntry_t entry;
+                    entry.name = fullName;
+                    entry.source = (int32_t)source;
+                    entry.claimPath = leasePath;
+                    if (_freshness != fresh_FIFO || _maxAge > 0) {
+                        entry.mtimeUs = getMtimeUs(entry.name);
+                    }
+                    if (_replayMode != replay_NONE && !getReplayTimestamp(entry.name, match, entry.timestampUs)) {
+                        ostringstream oss;
+                        oss << "dfESPbfileConnector::scanDirectory(): no replay timestamp for file " << entry.name << ", publishing it without delay";
+                        eLOG_INFO("Connectors0110", (  oss.str().c_str() ) ); 
+                        entry.timestampUs = INT64_MIN;
+                    }
+                    _workingFileList.push_back(entry);
+                }
+                
+            }
+        }
+        ent = port::Dir::readdir(dir);
+    }
+    port::Dir::closedir(dir);
+    return true;
+}
+
+bool dfESPbfileConnector::readManifestBatch(const std::regex &rgx) {
+    _workingFileList.clear();
+    if (!_manifest.is_open()) {
+        _manifest.clear();
+        _manifest.open(_manifestFile.c_str());
+        if (!_manifest.is_open()) {
+            ostringstream oss;
+            oss << "ERROR: could not open manifest: " << _manifestFile ;
+            eLOG_ERROR("Connectors0110", (  oss.str().c_str() ) ); 
+            return false;
+        }
+        //
+        // resume: skip the lines already published
+        //
+        std::string line;
+        int64_t skipped = 0;
+        while (skipped < _manifestLine && std::getline(_manifest, line)) {
+            skipped++;
+        }
+        _manifestLine = skipped;
+    }
+
+    std::string line;
+    std::smatch match;
+    while ((int32_t)_workingFileList.size() < _manifestBatch) {
+        if (!std::getline(_manifest, line)) {
+            _manifestEof = true;
+            _manifest.close();
+            break;
+        }
+        int64_t lineNumber = _manifestLine++;
+        //
+        // path [<TAB> metadata], empty lines and # comments are skipped
+        //
+        if (!line.empty() && line[line.size() - 1] == '\r') {
+            line.erase(line.size() - 1);
+        }
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        bfileEntry_t entry;
+        size_t tab = line.find('\t');
+        if (tab != std::string::npos) {
+            entry.metadata = line.substr(tab + 1);
+            line.erase(tab);
+        }
+        if (line[0] != '/' && !_filePath.empty()) {
+            entry.name = _filePath.c_str() + std::string("/") + line;
+        } else {
+            entry.name = line;
+        }
+        entry.line = lineNumber;
+        std::string fileName = line.substr(line.find_last_of('/') + 1);
+        if (!_shard.owns(fileName)) {
+            continue;
+        }
+        if (!_fileNameRgx.empty()) {
+            if (!regex_match(fileName, match, rgx)) {
+                continue;
+            }
+        }
+        if (_replayMode != replay_NONE && !getReplayTimestamp(entry.name, match, entry.timestampUs)) {
+            entry.timestampUs = INT64_MIN;
+        }
+        _workingFileList.push_back(entry);
+    }
+    // the manifest order is the publishing order, no sort
+    return true;
+}
+
+void dfESPbfileConnector::scheduleFileList() {
+    //
+    // newest first for live directories
+    //
+    if (_freshness != fresh_FIFO) {
+        std::sort (_workingFileList.begin(),_workingFileList.end(), [](const bfileEntry_t &a, const bfileEntry_t &b) {
+            return a.mtimeUs > b.mtimeUs || (a.mtimeUs == b.mtimeUs && a.name > b.name);
+        });
+        return;
+    }
+    //
+    // replay follows the recorded timestamps across all sources
+    //
+    if (_replayMode != replay_NONE) {
+        std::sort (_workingFileList.begin(),_workingFileList.end(), [](const bfileEntry_t &a, const bfileEntry_t &b) {
+            return a.timestampUs < b.timestampUs || (a.timestampUs == b.timestampUs && a.name < b.name);
+        });
+        return;
+    }
+    if (_sourceDirs.size() <= 1) {
+        std::sort (_workingFileList.begin(),_workingFileList.end(), [](const bfileEntry_t &a, const bfileEntry_t &b) {
+            return a.name < b.name;
+        });
+        return;
+    }
+    //
+    // weighted round robin: up to weight files from each source queue in turn, so that a busy source cannot starve the others
+    //
+    std::vector<std::vector<bfileEntry_t> > queues(_sourceDirs.size());
+    for (size_t j = 0; j < _workingFileList.size(); j++) {
+        queues[_workingFileList[j].source].push_back(std::move(_workingFileList[j]));
+    }
+    for (size_t q = 0; q < queues.size(); q++) {
+        std::sort (queues[q].begin(),queues[q].end(), [](const bfileEntry_t &a, const bfileEntry_t &b) {
+            return a.name < b.name;
+        });
+    }
+    size_t total = _workingFileList.size();
+    _workingFileList.clear();
+    std::vector<size_t> next(queues.size(), 0);
+    while (_workingFileList.size() < total) {
+        for (size_t q = 0; q < queues.size(); q++) {
+            for (int32_t w = 0; w < _sourceDirs[q].weight && next[q] < queues[q].size(); w++) {
+                _workingFileList.push_back(std::move(queues[q][next[q]++]));
+            }
+        }
+    }
+}
+
+bool dfESPbfileConnector::getReplayTimestamp(const std::string &fullName, const std::smatch &match, int64_t &timestampUs) {
+    if (_replayMode == replay_MTIME) {
+        struct stat st;
+        if (stat(fullName.c_str(), &st) != 0) {
+            return false;
+        }
+#if defined(OS_LINUX)
+        timestampUs = (int64_t)st.st_mtim.tv_sec * 1000000 + st.st_mtim.tv_nsec / 1000;
+#else
+        timestampUs = (int64_t)st.st_mtime * 1000000;
+#endif
+        return true;
+    }
+    //
+    // replay_FILENAME: the capture group must be an integer in replaytsunit
+    //
+    if ((size_t)_replayTsGroup >= match.size() || !match[_replayTsGroup].matched) {
+        return false;
+    }
+    std::string group = match[_replayTsGroup].str();
+    char *end = nullptr;
+    errno = 0;
+    long long value = strtoll(group.c_str(), &end, 10);
+    if (group.empty() || *end != '\0' || errno == ERANGE) {
+        return false;
+    }
+    timestampUs = (int64_t)value * _replayTsNsPerUnit / 1000;
+    return true;
+}
+
+bool dfESPbfileConnector::waitReplaySlot(size_t i) {
+    int64_t timestampUs = _workingFileList[i].timestampUs;
+    if (timestampUs == INT64_MIN || _replaySpeed <= 0.0) {
+        return 0 == _threadStop.get();
+    }
+    //
+    // the schedule is anchored on the first file of the pass with a timestamp
+    //
+    if (_replayAnchorUs == INT64_MIN) {
+        _replayAnchorUs = timestampUs;
+        _replayStart = std::chrono::steady_clock::now();
+        return 0 == _threadStop.get();
+    }
+    int64_t offsetUs = static_cast<int64_t>((timestampUs - _replayAnchorUs) / _replaySpeed);
+    auto due = _replayStart + std::chrono::microseconds(offsetUs);
+
+    auto now = std::chrono::steady_clock::now();
+    while (now < due) {
+        if (0 != _threadStop.get()) {
+            return false;
+        }
+        if (!injectStale()) {
+            return false;
+        }
+        std::this_thread::sleep_for(std::min<std::chrono::steady_clock::duration>(due - now, std::chrono::milliseconds(100)));
+        now = std::chrono::steady_clock::now();
+    }
+    int64_t driftUs = std::chrono::duration_cast<std::chrono::microseconds>(now - due).count();
+    _replayDriftCount++;
+    _replayDriftSumUs += driftUs;
+    if (driftUs > _replayDriftMaxUs) {
+        _replayDriftMaxUs = driftUs;
+    }
+    return 0 == _threadStop.get();
+}
+
+
+bool dfESPbfileConnector::growReadBuff(size_t length) {
+    // grow the read buffer only when needed, adding 1 for the ending NULL in case of string
+    if (!dfESPbfileGrowBuffer(_readBuff, _readBuffSize, length)) {
+        eLOG_MALLOC_fault((int64_t)length + 1);
+        return false;
+    }
+    return true;
+}
+
+int64_t dfESPbfileConnector::traceNowUs() {
+    // wall clock time measured with the monotonic clock, anchored once in the constructor
+    return _traceWallUs0 + std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - _traceMono0).count();
+}
+
+bool dfESPbfileConnector::readFile(const std::string &fileName, int64_t &fileSize) {
+    _traceUs[trace_READSTART] = traceNowUs();
+    struct stat st;
+    st.st_size = 0;
+    if (!dfESPbfileReadFile(fileName.c_str(), _publishAsBinary, _readBuff, _readBuffSize, fileSize, st)) {
+        if (errno == ENOMEM) {
+            eLOG_MALLOC_fault((int64_t)st.st_size + 1);
+        }
+        return false;
+    }
+#if defined(OS_LINUX)
+    _traceUs[trace_MTIME] = (int64_t)st.st_mtim.tv_sec * 1000000 + st.st_mtim.tv_nsec / 1000;
+#else
+    _traceUs[trace_MTIME] = (int64_t)st.st_mtime * 1000000;
+#endif
+    _traceUs[trace_READEND] = traceNowUs();
+    return true;
+}
+
+bool dfESPbfileConnector::publishBuffer(char *data, int64_t length, const char *name, const char *metadata, bool *retry) {
+    // Probe, before anything is built
+    bfileProbe_t probe;
+    if (_probe != probe_NONE && _publishAsBinary) {
+        probe = probeFrame((const unsigned char *)data, length);
+        if (probe.status == probe_OK &&
+            ((_probeWidth > 0 && probe.width != _probeWidth) || (_probeHeight > 0 && probe.height != _probeHeight))) {
+            probe.status = probe_WRONGSIZE;
+        }
+        if (probe.status != probe_OK && _probe >= probe_REJECT) {
+            if (probe.status == probe_TRUNCATED && retry) {
+                // probably still being written, the caller tries again later
+                *retry = true;
+                _probeRetried++;
+                return true;
+            }
+            rejectFrame(probe, data, length, name);
+            return true;
+        }
+        for (int32_t p = 0; p < probe_FIELDCOUNT; p++) {
+            if (_probeFieldIdx[p] < 0) {
+                continue;
+            }
+            int64_t value = p == 0 ? probe.width : (p == 1 ? probe.height : probe.channels);
+            if (probe.format == nullptr) {
+                _dvv[_probeFieldIdx[p]]->setNull();
+            } else if (_schema->getTypeEO(_probeFieldIdx[p]) == dfESPdatavar::ESP_INT32) {
+                int32_t value32 = (int32_t)value;
+                _dvv[_probeFieldIdx[p]]->setValue(dfESPdatavar::ESP_INT32, &value32);
+            } else {
+                _dvv[_probeFieldIdx[p]]->setValue(dfESPdatavar::ESP_INT64, &value);
+            }
+        }
+        if (_formatFieldIdx >= 0) {
+            _dvv[_formatFieldIdx]->setStringOrRstring( (char*)(probe.format ? probe.format : "unknown") );
+        }
+    }
+    // ID
+    _dvv[0]->setValue(dfESPdatavar::ESP_INT64, &_frameNumber);
+    // File content
+    if (_publishAsBinary) {
+        dfESPblob  *myBlob = dfESPblob::create(length, data, true);
+        _dvv[1]->setDataCopy(myBlob);
+        dfESPvblob::destroy(myBlob);
+    } else {
+        data[length] = '\0'; // adding ending NULL to the string as it is probably not present in the file. 
+        _dvv[1]->setStringOrRstring(data);
+    }
+    // File name
+    if (_fileNameFieldIdx >= 0) {  
+        _dvv[_fileNameFieldIdx]->setStringOrRstring( (char*)name );
+    }
+    // Manifest metadata
+    if (_metadataFieldIdx >= 0) {  
+        _dvv[_metadataFieldIdx]->setStringOrRstring( (char*)metadata );
+    }
+    // Trace: trace_inject is when the event is queued in the current block, the block
+    // itself is injected once it is full, so it can be later with blocksize > 1
+    _traceUs[trace_INJECT] = traceNowUs();
+    for (int32_t t = 0; t < trace_COUNT; t++) {
+        if (_traceFieldIdx[t] >= 0) {
+            _dvv[_traceFieldIdx[t]]->setValue(dfESPdatavar::ESP_INT64, &_traceUs[t]);
+        }
+    }
+
+    return buildEvent();
+}
+
+static inline uint32_t readBE32(const unsigned char *p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+dfESPbfileConnector::bfileProbe_t dfESPbfileConnector::probeFrame(const unsigned char *data, int64_t length) {
+    bfileProbe_t probe;
+    static const unsigned char pngSignature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+
+    if (length >= 4 && data[0] == 0xff && data[1] == 0xd8) {
+        //
+        // JPEG: walk the marker segments up to SOS for the SOFn frame header, then look for EOI at the end
+        //
+        probe.format = "jpeg";
+        int64_t pos = 2;
+        bool sof = false;
+        while (true) {
+            if (pos + 4 > length) {
+                probe.status = probe_TRUNCATED;
+                return probe;
+            }
+            if (data[pos] != 0xff) {
+                probe.status = probe_MALFORMED;
+                return probe;
+            }
+            while (pos + 4 <= length && data[pos + 1] == 0xff) {
+                pos++; // fill bytes
+            }
+            if (pos + 4 > length) {
+                probe.status = probe_TRUNCATED;
+                return probe;
+            }
+            unsigned char marker = data[pos + 1];
+            if (marker == 0x01 || (marker >= 0xd0 && marker <= 0xd7)) {
+                pos += 2; // no length
+                continue;
+            }
+            if (marker == 0xd9) {
+                // EOI before any scan
+                probe.status = probe_MALFORMED;
+                return probe;
+            }
+            int64_t segment = ((int64_t)data[pos + 2] << 8) | data[pos + 3];
+            if (segment < 2) {
+                probe.status = probe_MALFORMED;
+                return probe;
+            }
+            if (pos + 2 + segment > length) {
+                probe.status = probe_TRUNCATED;
+                return probe;
+            }
+            if (marker >= 0xc0 && marker <= 0xcf && marker != 0xc4 && marker != 0xc8 && marker != 0xcc) {
+                // SOFn: precision, height, width, components
+                if (segment < 8) {
+                    probe.status = probe_MALFORMED;
+                    return probe;
+                }
+                probe.height = ((int32_t)data[pos + 5] << 8) | data[pos + 6];
+                probe.width = ((int32_t)data[pos + 7] << 8) | data[pos + 8];
+                probe.channels = data[pos + 9];
+                sof = true;
+            }
+            pos += 2 + segment;
+            if (marker == 0xda) {
+                break; // SOS, entropy-coded data follows
+            }
+        }
+        if (!sof || probe.width == 0 || probe.height == 0) {
+            probe.status = probe_MALFORMED;
+            return probe;
+        }
+        // some encoders pad after EOI, accept it in the last bytes
+        int64_t tail = length - 32 > pos ? length - 32 : pos;
+        probe.status = probe_TRUNCATED;
+        for (int64_t i = length - 2; i >= tail; i--) {
+            if (data[i] == 0xff && data[i + 1] == 0xd9) {
+                probe.status = probe_OK;
+                break;
+            }
+        }
+        return probe;
+    }
+
+    if (length >= 8 && memcmp(data, pngSignature, sizeof(pngSignature)) == 0) {
+        //
+        // PNG: the first chunk is IHDR, the last one IEND
+        //
+        probe.format = "png";
+        if (length < 8 + 8 + 13 + 4) {
+            probe.status = probe_TRUNCATED;
+            return probe;
+        }
+        if (readBE32(data + 8) != 13 || memcmp(data + 12, "IHDR", 4) != 0) {
+            probe.status = probe_MALFORMED;
+            return probe;
+        }
+        probe.width = (int32_t)readBE32(data + 16);
+        probe.height = (int32_t)readBE32(data + 20);
+        switch (data[25]) { // color type
+            case 0: probe.channels = 1; break; // grayscale
+            case 2: probe.channels = 3; break; // RGB
+            case 3: probe.channels = 1; break; // palette
+            case 4: probe.channels = 2; break; // grayscale and alpha
+            case 6: probe.channels = 4; break; // RGBA
+            default:
+                probe.status = probe_MALFORMED;
+                return probe;
+        }
+        if (probe.width <= 0 || probe.height <= 0) {
+            probe.status = probe_MALFORMED;
+            return probe;
+        }
+        probe.status = (length >= 8 + 8 + 13 + 4 + 12 && readBE32(data + length - 12) == 0 && memcmp(data + length - 8, "IEND", 4) == 0) ?
+                       probe_OK : probe_TRUNCATED;
+        return probe;
+    }
+
+    if (length >= 24) {
+        //
+        // SAS wide: int64 rows, cols and OpenCV type, followed by the pixels, the length must match
+        //
+        int64_t header[3];
+        memcpy(header, data, sizeof(header));
+        int64_t rows = header[0];
+        int64_t cols = header[1];
+        int64_t type = header[2];
+        if (rows > 0 && rows <= 65535 && cols > 0 && cols <= 65535 && type >= 0 && type < 512) {
+            static const int64_t depthSize[8] = {1, 1, 2, 2, 4, 4, 8, 2};
+            int64_t channels = (type >> 3) + 1;
+            int64_t expected = 24 + rows * cols * channels * depthSize[type & 7];
+            probe.format = "wide";
+            probe.width = (int32_t)cols;
+            probe.height = (int32_t)rows;
+            probe.channels = (int32_t)channels;
+            probe.status = length == expected ? probe_OK : (length < expected ? probe_TRUNCATED : probe_MALFORMED);
+            return probe;
+        }
+    }
+
+    probe.status = probe_MALFORMED;
+    return probe;
+}
+
+void dfESPbfileConnector::rejectFrame(const bfileProbe_t &probe, const char *data, int64_t length, const char *name) {
+    switch (probe.status) {
+        case probe_TRUNCATED: _probeTruncated++; break;
+        case probe_WRONGSIZE: _probeWrongSize++; break;
+        default:              _probeMalformed++; break;
+    }
+    if (_probe == probe_QUARANTINE) {
+        // frame number first, several streamed records have the same name
+        std::string baseName = name;
+        baseName = baseName.substr(baseName.find_last_of('/') + 1);
+        std::string quarantined = std::string(_quarantinePath.c_str()) + "/" + to_string(static_cast<long long>(_frameNumber)) + "_" + baseName;
+        FILE *target = fopen(quarantined.c_str(), "wb");
+        if (target == nullptr || fwrite(data, 1, (size_t)length, target) != (size_t)length) {
+            ostringstream oss;
+            oss << "dfESPbfileConnector::rejectFrame(): could not write " << quarantined << " " << strerror(errno);
+            eLOG_ERROR("Connectors0110", (  oss.str().c_str() ) ); 
+        } else {
+            _probeQuarantined++;
+        }
+        if (target) {
+            fclose(target);
+        }
+    }
+    reportDropped(false);
+}
+
+void dfESPbfileConnector::getProbeCounters(int64_t &truncated, int64_t &malformed, int64_t &wrongSize, int64_t &quarantined) const {
+    truncated = _probeTruncated.load();
+    malformed = _probeMalformed.load();
+    wrongSize = _probeWrongSize.load();
+    quarantined = _probeQuarantined.load();
+}
+
+static void unlinkSocket(const char *path) {
+    struct stat st;
+    if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+        unlink(path);
+    }
+}
+
+int dfESPbfileConnector::openStream() {
+    if (_source == source_FIFO) {
+        // opened read/write so that the FIFO never reports end of file when the last writer goes away
+        int fd = ::open(_filePath.c_str(), O_RDWR | O_NONBLOCK);
+        if (fd < 0) {
+            ostringstream oss;
+            oss << "ERROR: could not open FIFO: " << _filePath << " " << strerror(errno);
+            eLOG_ERROR("Connectors0110", (  oss.str().c_str() ) ); 
+        }
+        return fd;
+    }
+    //
+    // source_SOCKET: listen on the path, producers connect to it one at a time
+    //
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (_filePath.size() >= sizeof(addr.sun_path)) {
+        ostringstream oss;
+        oss << "ERROR: socket path too long: " << _filePath ;
+        eLOG_ERROR("Connectors0110", (  oss.str().c_str() ) ); 
+        return -1;
+    }
+    strncpy(addr.sun_path, _filePath.c_str(), sizeof(addr.sun_path) - 1);
+    // a socket left by a previous run, never a file of a misconfigured path
+    unlinkSocket(_filePath.c_str());
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, 1) != 0) {
+        ostringstream oss;
+        oss << "ERROR: could not listen on socket: " << _filePath << " " << strerror(errno);
+        eLOG_ERROR("Connectors0110", (  oss.str().c_str() ) ); 
+        if (fd >= 0) {
+            ::close(fd);
+        }
+        return -1;
+    }
+    return fd;
+}
+
+int dfESPbfileConnector::readStream(int fd, char *buff, size_t length) {
+    size_t done = 0;
+    while (done < length) {
+        struct pollfd pfd;
+        pfd.fd = fd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        // wake up regularly to honor _threadStop
+        int rc = poll(&pfd, 1, 100);
+        if (0 != _threadStop.get()) {
+            return -1;
+        }
+        if (rc < 0 && errno != EINTR) {
+            return -1;
+        }
+        if (rc <= 0) {
+            if (done == 0 && !injectStale()) {
+                return -1;
+            }
+            continue;
+        }
+        if (_traceUs[trace_READSTART] == 0) {
+            _traceUs[trace_READSTART] = traceNowUs();
+        }
+        ssize_t n = ::read(fd, buff + done, length - done);
+        if (n == 0) {
+            // peer closed, a partial record is lost
+            return done == 0 ? 0 : -1;
+        }
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        done += (size_t)n;
+    }
+    return 1;
+}
+
+void dfESPbfileConnector::publishStream() {
+    int streamFd = openStream();
+    if (streamFd < 0) {
+        return;
+    }
+    ostringstream oss;
+    oss << "dfESPbfileConnector::publishStream(): "<< "publishing records from " << _filePath << " as " << (_publishAsBinary? "binary":"string") << " fields" ;
+    eLOG_INFO("Connectors0110", (  oss.str().c_str() ) ); 
+
+    int fd = (_source == source_FIFO) ? streamFd : -1;
+    std::string recordName;
+    auto lastTime = std::chrono::steady_clock::now();
+
+    while (0 == _threadStop.get()) {
+        if (fd < 0) {
+            //
+            // wait for the next producer
+            //
+            struct pollfd pfd;
+            pfd.fd = streamFd;
+            pfd.events = POLLIN;
+            pfd.revents = 0;
+            if (poll(&pfd, 1, 100) <= 0) {
+                if (!injectStale()) {
+                    break;
+                }
+                continue;
+            }
+            fd = accept(streamFd, NULL, NULL);
+            continue;
+        }
+        //
+        // record: [uint32 name length][name] when recordname is true, then [uint32 data length][data], lengths in network order
+        //
+        uint32_t length = 0;
+        int rc = 1;
+        recordName.clear();
+        // a record has no file, it "arrives" when its first byte can be read
+        _traceUs[trace_READSTART] = 0;
+        if (_recordName) {
+            rc = readStream(fd, (char *)&length, sizeof(length));
+            if (rc > 0 && (int64_t)ntohl(length) > _maxRecordSize) {
+                rc = -1;
+            } else if (rc > 0) {
+                recordName.resize(ntohl(length));
+                rc = recordName.empty() ? 1 : readStream(fd, &recordName[0], recordName.size());
+            }
+        }
+        if (rc > 0) {
+            rc = readStream(fd, (char *)&length, sizeof(length));
+        }
+        if (rc > 0) {
+            length = ntohl(length);
+            if ((int64_t)length > _maxRecordSize) {
+                ostringstream oss;
+                oss << "ERROR: record of " << length << " bytes larger than maxrecordsize, closing " << _filePath ;
+                eLOG_ERROR("Connectors0110", (  oss.str().c_str() ) ); 
+                rc = -1;
+            } else if (!growReadBuff(length)) {
+                rc = -1;
+            } else {
+                rc = readStream(fd, _readBuff, length);
+            }
+        }
+        _traceUs[trace_MTIME] = _traceUs[trace_READSTART];
+        _traceUs[trace_READEND] = traceNowUs();
+        if (rc <= 0) {
+            if (0 != _threadStop.get()) {
+                break;
+            }
+            if (_source == source_FIFO) {
+                // out of sync or error: there is no way to find the next record boundary in a FIFO
+                eLOG_ERROR("Connectors0110", (  "dfESPbfileConnector::publishStream(): error reading FIFO" ) ); 
+                break;
+            }
+            ::close(fd);
+            fd = -1;
+            continue;
+        }
+
+        if (_publishPeriod > 0) {
+            auto due = lastTime + std::chrono::microseconds(_publishPeriod);
+            auto now = std::chrono::steady_clock::now();
+            if (due > now) {
+                _adaptiveRateLimited = true;
+            }
+            // sleep by chunks so that a low publishrate does not delay stop()
+            while (now < due && 0 == _threadStop.get()) {
+                std::this_thread::sleep_for(std::min<std::chrono::steady_clock::duration>(due - now, std::chrono::milliseconds(100)));
+                now = std::chrono::steady_clock::now();
+            }
+            if (0 != _threadStop.get()) {
+                break;
+            }
+            lastTime = now;
+        }
+        if (!publishBuffer(_readBuff, length, _recordName ? recordName.c_str() : _filePath.c_str())) {
+            break;
+        }
+        _frameNumber++;
+        checkpointProgress("");
+    }
+
+    if (fd >= 0 && fd != streamFd) {
+        ::close(fd);
+    }
+    ::close(streamFd);
+    if (_source == source_SOCKET) {
+        unlinkSocket(_filePath.c_str());
+    }
+}
+
+bool dfESPbfileConnector::readFollowed(const std::string &name, bfileFollow_t &followed, int64_t mtimeUs) {
+    //
+    // read the appended bytes by chunks of followchunk, behind the carried partial record
+    //
+    for (;;) {
+        size_t carry = followed.carry.size();
+        if (!growReadBuff(carry + (size_t)_followChunk)) {
+            return false;
+        }
+        _traceUs[trace_READSTART] = traceNowUs();
+        ssize_t n = pread(followed.fd, _readBuff + carry, (size_t)_followChunk, followed.offset);
+        if (n <= 0) {
+            return true;
+        }
+        _traceUs[trace_MTIME] = mtimeUs;
+        _traceUs[trace_READEND] = traceNowUs();
+        followed.offset += n;
+        if (carry) {
+            memcpy(_readBuff, followed.carry.data(), carry);
+        }
+        size_t length = carry + (size_t)n;
+
+        // file offset of the first byte of _readBuff
+        int64_t base = followed.offset - (int64_t)length;
+
+        if (_recordDelimiter.empty()) {
+            // no record boundary: each read is an event
+            if (!publishBuffer(_readBuff, length, name.c_str())) {
+                return false;
+            }
+            _frameNumber++;
+            followed.done = followed.offset;
+            checkpointProgress(name, &followed);
+            continue;
+        }
+        size_t begin = 0;
+        for (;;) {
+            char *found = std::search(_readBuff + begin, _readBuff + length, _recordDelimiter.begin(), _recordDelimiter.end());
+            if (found == _readBuff + length) {
+                break;
+            }
+            size_t end = found - _readBuff;
+            if (!publishBuffer(_readBuff + begin, end - begin, name.c_str())) {
+                return false;
+            }
+            _frameNumber++;
+            begin = end + _recordDelimiter.size();
+            followed.done = base + (int64_t)begin;
+            checkpointProgress(name, &followed);
+        }
+        if (length - begin >= (size_t)_followChunk) {
+            // a record longer than followchunk is cut to keep the buffer bounded
+            if (!publishBuffer(_readBuff + begin, length - begin, name.c_str())) {
+                return false;
+            }
+            _frameNumber++;
+            begin = length;
+            followed.done = followed.offset;
+            checkpointProgress(name, &followed);
+        }
+        followed.carry.assign(_readBuff + begin, length - begin);
+    }
+}
+
+bool dfESPbfileConnector::publishCarry(const std::string &name, bfileFollow_t &followed) {
+    if (followed.carry.empty()) {
+        return true;
+    }
+    // the file is gone or rotated, its last record will never get a delimiter
+    size_t length = followed.carry.size();
+    if (!growReadBuff(length)) {
+        return false;
+    }
+    memcpy(_readBuff, followed.carry.data(), length);
+    followed.carry.clear();
+    if (!publishBuffer(_readBuff, length, name.c_str())) {
+        return false;
+    }
+    _frameNumber++;
+    followed.done = followed.offset;
+    checkpointProgress(name, &followed);
+    return true;
+}
+
+bool dfESPbfileConnector::followFile(const std::string &name) {
+    auto found = _followedFiles.find(name);
+    struct stat st;
+    if (stat(name.c_str(), &st) != 0) {
+        //
+        // removed or renamed away: publish what was appended before, then forget the file
+        //
+        if (found != _followedFiles.end()) {
+            bool ok = readFollowed(name, found->second, 0) && publishCarry(name, found->second);
+            ::close(found->second.fd);
+            _followedFiles.erase(found);
+            _checkpoint.followed.erase(name);
+            return ok;
+        }
+        return true;
+    }
+#if defined(OS_LINUX)
+    int64_t mtimeUs = (int64_t)st.st_mtim.tv_sec * 1000000 + st.st_mtim.tv_nsec / 1000;
+#else
+    int64_t mtimeUs = (int64_t)st.st_mtime * 1000000;
+#endif
+    if (found != _followedFiles.end() && found->second.inode != st.st_ino) {
+        //
+        // rotated: finish the old file through the descriptor still open on it, then start the new one
+        //
+        bool ok = readFollowed(name, found->second, mtimeUs) && publishCarry(name, found->second);
+        ::close(found->second.fd);
+        _followedFiles.erase(found);
+        found = _followedFiles.end();
+        if (!ok) {
+            return false;
+        }
+    }
+    if (found == _followedFiles.end()) {
+        bfileFollow_t followed;
+        followed.fd = ::open(name.c_str(), O_RDONLY);
+        if (followed.fd < 0) {
+            return true; // not readable yet
+        }
+        followed.inode = st.st_ino;
+        auto resumed = _followResume.find(name);
+        if (resumed != _followResume.end()) {
+            //
+            // checkpointed by the previous active node: resume after its last published record
+            //
+            if (resumed->second.inode == (uint64_t)st.st_ino && resumed->second.done <= st.st_size) {
+                followed.offset = followed.done = resumed->second.done;
+            } else {
+                ostringstream oss;
+                oss << "dfESPbfileConnector::followFile(): " << name << " was rotated or truncated since the checkpoint, reading it from its start";
+                eLOG_INFO("Connectors0110", (  oss.str().c_str() ) ); 
+            }
+            _followResume.erase(resumed);
+        }
+        found = _followedFiles.insert(std::make_pair(name, followed)).first;
+    }
+    if (st.st_size < found->second.offset) {
+        // truncated in place
+        found->second.offset = 0;
+        found->second.done = 0;
+        found->second.carry.clear();
+    }
+    if (st.st_size == found->second.offset) {
+        return true;
+    }
+    return readFollowed(name, found->second, mtimeUs);
+}
+
+void dfESPbfileConnector::publishFollow() {
+    // followed files are listed on every scan, the resume position is kept per file
+    _resumeFromCheckpoint = false;
+    std::regex rgx;
+    try {
+        rgx = _fileNameRgx.c_str();
+    } catch (const std::regex_error& e) {
+        // already reported by getFileList()
+    }
+    //
+    // initial scan, also registers the source directories
+    //
+    _workingFileList.clear();
+    if (!getFileList()) {
+        eLOG_ERROR("Connectors0110", (  "Error getting file list" ) ); 
+        return;
+    }
+    ostringstream oss;
+    oss << "dfESPbfileConnector::publishFollow(): "<< "following " << _workingFileList.size() << " files as " << (_publishAsBinary? "binary":"string") << " fields" ;
+    eLOG_INFO("Connectors0110", (  oss.str().c_str() ) ); 
+    for (size_t i = 0; i < _workingFileList.size() && 0 == _threadStop.get(); i++) {
+        if (!followFile(_workingFileList[i].name)) {
+            return;
+        }
+    }
+    // checkpointed files removed meanwhile are not kept in the journal
+    for (auto resumed = _followResume.begin(); resumed != _followResume.end(); ) {
+        struct stat st;
+        if (stat(resumed->first.c_str(), &st) != 0) {
+            _checkpoint.followed.erase(resumed->first);
+            resumed = _followResume.erase(resumed);
+        } else {
+            ++resumed;
+        }
+    }
+
+    int notifyFd = -1;
+    std::map<int, std::string> watches;
+#if defined(OS_LINUX)
+    notifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (notifyFd >= 0) {
+        for (size_t d = 0; d < _sourceDirs.size(); d++) {
+            int wd = inotify_add_watch(notifyFd, _sourceDirs[d].path.c_str(), IN_MODIFY | IN_CREATE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE);
+            if (wd >= 0) {
+                watches[wd] = _sourceDirs[d].path;
+            }
+        }
+    }
+#endif
+    if (notifyFd < 0) {
+        eLOG_INFO("Connectors0110", (  "dfESPbfileConnector::publishFollow(): inotify not available, polling" ) ); 
+    }
+
+    auto lastPoll = std::chrono::steady_clock::now();
+    while (0 == _threadStop.get()) {
+#if defined(OS_LINUX)
+        if (notifyFd >= 0) {
+            struct pollfd pfd;
+            pfd.fd = notifyFd;
+            pfd.events = POLLIN;
+            pfd.revents = 0;
+            if (poll(&pfd, 1, 100) > 0) {
+                alignas(struct inotify_event) char events[16384];
+                ssize_t n;
+                while ((n = ::read(notifyFd, events, sizeof(events))) > 0) {
+                    for (char *p = events; p < events + n; p += sizeof(struct inotify_event) + ((struct inotify_event *)p)->len) {
+                        struct inotify_event *event = (struct inotify_event *)p;
+                        auto watch = watches.find(event->wd);
+                        if (event->len == 0 || watch == watches.end() || !_shard.owns(event->name) ||
+                            !regex_match(std::string(event->name), rgx)) {
+                            continue;
+                        }
+                        if (!followFile(watch->second + "/" + event->name)) {
+                            ::close(notifyFd);
+                            return;
+                        }
+                    }
+                }
+            }
+        } else {
+            gMilliSleep(100);
+        }
+#else
+        gMilliSleep(100);
+#endif
+        if (!injectStale()) {
+            break;
+        }
+        //
+        // periodic check of all the files, for events missed by inotify and new subdirectories
+        //
+        if (std::chrono::steady_clock::now() - lastPoll >= std::chrono::milliseconds(_followPoll)) {
+            lastPoll = std::chrono::steady_clock::now();
+            _workingFileList.clear();
+            if (getFileList()) {
+                for (size_t i = 0; i < _workingFileList.size() && 0 == _threadStop.get(); i++) {
+                    if (!followFile(_workingFileList[i].name)) {
+                        if (notifyFd >= 0) {
+                            ::close(notifyFd);
+                        }
+                        return;
+                    }
+                }
+            }
+#if defined(OS_LINUX)
+            if (notifyFd >= 0 && watches.size() < _sourceDirs.size()) {
+                for (size_t d = 0; d < _sourceDirs.size(); d++) {
+                    int wd = inotify_add_watch(notifyFd, _sourceDirs[d].path.c_str(), IN_MODIFY | IN_CREATE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE);
+                    if (wd >= 0) {
+                        watches[wd] = _sourceDirs[d].path;
+                    }
+                }
+            }
+#endif
+        }
+    }
+    if (notifyFd >= 0) {
+        ::close(notifyFd);
+    }
+}
+
+bool dfESPbfileConnector::publishFile(const bfileEntry_t &entry, bool *retry) {
+    if (_maxAge > 0 && isStale(entry)) {
+        dropStale(entry);
+        return true;
+    }
+    //
+    // reading file into the reusable read buffer
+    //
+    int64_t fileSize = 0;
+    bool published = false;
+    std::string readName;
+    //
+    // a truncated file of a directory, modified within probegrace, is probably still being written
+    //
+    bool canRetry = false;
+    struct stat before;
+    if (retry && _probe >= probe_REJECT && _manifestFile.empty() &&
+        stat((entry.claimPath.empty() ? entry.name : entry.claimPath).c_str(), &before) == 0) {
+        int64_t nowUs = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+        canRetry = nowUs - (int64_t)before.st_mtime * 1000000 <= _probeGrace * 1000;
+    }
+    dfESPbfileShard::claim_t claim = _shard.claim(entry.name, entry.claimPath, readName);
+    while (claim == dfESPbfileShard::claim_BUSY && !retry) {
+        //
+        // manifest lines are published in order: wait for the other instance to complete the file, or for its claim to expire
+        //
+        if (0 != _threadStop.get()) {
+            return true;
+        }
+        if (!injectStale()) {
+            return false;
+        }
+        gMilliSleep(100);
+        claim = _shard.claim(entry.name, entry.claimPath, readName);
+    }
+    if (claim == dfESPbfileShard::claim_BUSY) {
+        // claimed by another instance: tried again later, taken over once the claim expires
+        *retry = true;
+        return true;
+    }
+    if (claim != dfESPbfileShard::claim_OWNED) {
+        if (claim == dfESPbfileShard::claim_ERROR) {
+            ostringstream oss;
+            oss << "dfESPbfileConnector::publishFile(): could not claim " << entry.name << " " << strerror(errno);
+            eLOG_ERROR("Connectors0110", (  oss.str().c_str() ) ); 
+        } else {
+            // another instance has it
+            _claimsLost++;
+        }
+        if (_manifestFile.empty()) {
+            _processedFileList.insert(entry.name);
+        } else {
+            _manifestDoneLine = entry.line + 1;
+        }
+        return true;
+    }
+    if (readFile(readName, fileSize))
+    {
+        eLOG_DEBUG ("Connectors0032", (  "captured fileLength=", to_string(fileSize), "ok" ) );
+        //
+        // publishing file
+        //
+        if(!publishBuffer(_readBuff, fileSize, entry.name.c_str(), entry.metadata.c_str(), canRetry ? retry : nullptr)) {
+            return false;
+        }
+        if (canRetry && *retry) {
+            //
+            // not processed, not claimed and no event ID
+            //
+            _shard.release(entry.name, readName, before);
+            return true;
+        }
+
+        if (_manifestFile.empty()) {
+            _processedFileList.insert(entry.name);
+        }
+        if (_shard.mode != dfESPbfileShard::mode_NONE) {
+            // the claim is completed once the event is injected, a crash before that lets it expire
+            _shard.queueComplete(entry.name, readName);
+            if (_trans.empty()) {
+                _shard.commit();
+            }
+        }
+        published = true;
+    }
+    else  {
+        eLOG_ERROR("Connectors0110", (  "Unable to open file" ) ); 
+    }
+
+    _frameNumber++;
+    if (!_manifestFile.empty()) {
+        _manifestDoneLine = entry.line + 1;
+    }
+    if (published) {
+        checkpointProgress(entry.name);
+    }
+    return true;
+}
+
+int64_t dfESPbfileConnector::getMtimeUs(const std::string &fileName) {
+    struct stat st;
+    if (stat(fileName.c_str(), &st) != 0) {
+        return INT64_MIN;
+    }
+#if defined(OS_LINUX)
+    return (int64_t)st.st_mtim.tv_sec * 1000000 + st.st_mtim.tv_nsec / 1000;
+#else
+    return (int64_t)st.st_mtime * 1000000;
+#endif
+}
+
+bool dfESPbfileConnector::isStale(const bfileEntry_t &entry) {
+    int64_t mtimeUs = entry.mtimeUs != INT64_MIN ? entry.mtimeUs : getMtimeUs(entry.name);
+    if (mtimeUs == INT64_MIN) {
+        return false; // let readFile() report it
+    }
+    int64_t nowUs = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    return nowUs - mtimeUs > _maxAge * 1000;
+}
+
+void dfESPbfileConnector::dropStale(const bfileEntry_t &entry, bool superseded) {
+    if (_staleArchive) {
+        std::string archived = std::string(_archivePath.c_str()) + "/" + entry.name.substr(entry.name.find_last_of('/') + 1);
+        if (rename(entry.name.c_str(), archived.c_str()) == 0) {
+            _archivedFiles++;
+        } else {
+            ostringstream oss;
+            oss << "dfESPbfileConnector::dropStale(): could not archive " << entry.name << " to " << archived << " " << strerror(errno);
+            eLOG_ERROR("Connectors0110", (  oss.str().c_str() ) ); 
+            _droppedFiles++;
+        }
+    } else {
+        _droppedFiles++;
+    }
+    if (superseded) {
+        _supersededFiles++;
+    }
+    if (_manifestFile.empty()) {
+        _processedFileList.insert(entry.name);
+    } else {
+        _manifestDoneLine = entry.line + 1;
+    }
+    checkpointProgress(entry.name);
+}
 
-            if ( _publishPeriod == 0 || now - lastTime >= std::chrono::milliseconds(_publishPeriod)) {
+void dfESPbfileConnector::reportDropped(bool force) {
+    auto now = std::chrono::steady_clock::now();
+    int64_t total = _droppedFiles.load() + _archivedFiles.load() + _claimsLost + _shard.takeovers +
+                    _probeTruncated.load() + _probeMalformed.load() + _probeWrongSize.load() + _probeRetried.load();
+    if (total == _droppedReported || (!force && now - _droppedReportTime < std::chrono::seconds(5))) {
+        return;
+    }
+    _droppedReported = total;
+    _droppedReportTime = now;
+    ostringstream oss;
+    oss << "dfESPbfileConnector::reportDropped(): " << _droppedFiles.load() << " files dropped, " << _archivedFiles.load()
+        << " files archived, of which " << _supersededFiles.load() << " superseded by a newer file";
+    if (_shard.mode != dfESPbfileShard::mode_NONE) {
+        oss << ", " << _claimsLost << " files claimed by another instance, " << _shard.takeovers << " expired claims taken over";
+    }
+    if (_probe >= probe_REJECT) {
+        oss << ", frames rejected by the probe: " << _probeTruncated.load() << " truncated, " << _probeMalformed.load() << " malformed, "
+            << _probeWrongSize.load() << " of the wrong size, " << _probeQuarantined.load() << " quarantined, "
+            << _probeRetried.load() << " reads of truncated files retried";
+    }
+    eLOG_INFO("Connectors0110", (  oss.str().c_str() ) ); 
+}
+
+void dfESPbfileConnector::getDropCounters(int64_t &dropped, int64_t &archived, int64_t &superseded) const {
+    dropped = _droppedFiles.load();
+    archived = _archivedFiles.load();
+    superseded = _supersededFiles.load();
+}
+
+void dfESPbfileConnector::publishLive() {
+    auto lastScan = std::chrono::steady_clock::time_point();
+    auto lastTime = std::chrono::steady_clock::now();
+    size_t i = 0;
+    bool retried = false; // a truncated or busy file of the snapshot is left for the next scan
+    // there is no resume position in newest-first order: the processed files
+    // loaded from the checkpoint are simply not listed again
+    _resumeFromCheckpoint = false;
+    eLOG_INFO("Connectors0110", (  _freshness == fresh_LATEST ? "dfESPbfileConnector::publishLive(): publishing the latest file only" :
+                                                                "dfESPbfileConnector::publishLive(): publishing the newest files first" ) ); 
+
+    while (0 == _threadStop.get()) {
+        //
+        // rescan at most every 100ms, or as soon as the current snapshot is published
+        //
+        auto now = std::chrono::steady_clock::now();
+        if (i >= _workingFileList.size() && retried && now - lastScan < std::chrono::milliseconds(100)) {
+            // do not read a file still being written again before the next periodic scan
+            if (!injectStale()) {
+                break;
+            }
+            gMilliSleep(10);
+            continue;
+        }
+        if (i >= _workingFileList.size() || now - lastScan >= std::chrono::milliseconds(100)) {
+            lastScan = now;
+            _workingFileList.clear();
+            i = 0;
+            retried = false;
+            if (!getFileList()) {
+                eLOG_ERROR("Connectors0110", (  "Error getting file list" ) ); 
+                break;
+            }
+            if (_workingFileList.empty()) {
+                reportDropped(false);
+                if (!injectStale()) {
+                    break;
+                }
+                gMilliSleep(10);
+                continue;
+            }
+            if (_freshness == fresh_LATEST) {
                 //
-                // opening file
+                // only the newest file is published, the others are superseded
                 //
-                char * buff = nullptr;
-                std::streampos fileSize;
-                ios_base::openmode mode;
-
-                if (_publishAsBinary) {
-                    mode = ios::in|ios::binary|ios::ate;
-                } else {
-                    mode = ios::in|ios::ate;
+                size_t newest = 0;
+                for (size_t j = 1; j < _workingFileList.size(); j++) {
+                    if (_workingFileList[j].mtimeUs > _workingFileList[newest].mtimeUs) {
+                        newest = j;
+                    }
                 }
-                std::ifstream file (_workingFileList[i].c_str(), mode);
-
-                if (file.is_open())
-                {
-                    fileSize = file.tellg();
-                    buff = (char*)malloc((int64_t)fileSize + 1); // adding 1 for adding the ending NULL in case of string. 
-                    if (!buff) {
-                        eLOG_MALLOC_fault((int64_t)fileSize);
-                        error = true;
-                        file.close();
-                        break;
+                for (size_t j = 0; j < _workingFileList.size(); j++) {
+                    if (j != newest) {
+                        dropStale(_workingFileList[j], true);
                     }
-                    //
-                    // reading file
-                    //
-                    file.seekg(0, ios::beg);
-                    file.read(buff, fileSize);
-                    file.close();
+                }
+                _workingFileList[0] = _workingFileList[newest];
+                _workingFileList.resize(1);
+            }
+        }
+        if (_publishPeriod > 0 && now - lastTime < std::chrono::microseconds(_publishPeriod)) {
+            _adaptiveRateLimited = true;
+            std::this_thread::sleep_for( std::chrono::microseconds(_publishPeriod / 10) );
+            continue;
+        }
+        bool retry = false;
+        if (!publishFile(_workingFileList[i], &retry)) {
+            break;
+        }
+        if (retry) {
+            retried = true;
+        } else {
+            lastTime = now;
+        }
+        ++i;
+        reportDropped(false);
+    }
+    reportDropped(true);
+}
 
-                    eLOG_DEBUG ("Connectors0032", (  "captured fileLength=", to_string(fileSize), "ok" ) );
-                    //
-                    // publishing file
-                    //
-                    
-                    // ID
-                    _dvv[0]->setValue(dfESPdatavar::ESP_INT64, &frameNumber);
-                    // File content
-                    if (_publishAsBinary) {
-                        dfESPblob  *myBlob = dfESPblob::create(fileSize, buff, true);
-                        _dvv[1]->setDataCopy(myBlob);
-                        dfESPvblob::destroy(myBlob);
-                    } else {
-                        buff[fileSize] = NULL; // adding ending NULL to the string as it is probably not present in the file. 
-                        _dvv[1]->setStringOrRstring(buff);
-                    }
-                    // File name
-                    if (_dvv.size() == 3) {  
-                        _dvv[2]->setStringOrRstring( (char*)_workingFileList[i].c_str() );
-                    }
+void dfESPbfileConnector::publisherThread() {
 
-                    if(!buildEvent()) {
-                        //failed to build event
-                        error = true;
-                        break;
-                    }
+    dfESPptrVect<dfESPeventPtr> trans;
+    _schema->buildEventDatavarVect(_dvv);
+
+    bool error = false;
+
+    if (_adaptive) {
+        // start from publishrate when set, else from the upper bound and let the controller back off
+        if (_publishRate <= 0.0 || _publishRate > _adaptiveMaxRate) {
+            _publishRate = _adaptiveMaxRate;
+        } else if (_publishRate < _adaptiveMinRate) {
+            _publishRate = _adaptiveMinRate;
+        }
+        _adaptiveLastReport = std::chrono::steady_clock::now();
+        _adaptiveLastDecrease = _adaptiveLastReport;
+    }
+
+    if ( _publishRate <= 0.0) {
+        _publishPeriod = 0;
+    } else {
+        _publishPeriod = static_cast<int64_t>(1000000/_publishRate);
+    }
+        
+    auto lastTime = std::chrono::system_clock::now();
+
+    if (!_checkpointFile.empty() && !waitForPromotion()) {
+        // stopped while standby
+        dfESPconnector::setState(dfESPabsConnector::state_FINISHED);
+        _started = false;
+        return;
+    }
+
+    if (_follow) {
+        //
+        // appended bytes are published until the thread stops
+        //
+        publishFollow();
+        dfESPconnector::setState(dfESPabsConnector::state_FINISHED);
+        _started = false;
+        return;
+    }
+
+    if (_freshness != fresh_FIFO) {
+        //
+        // live directories: new files are published newest first until the thread stops
+        //
+        publishLive();
+        dfESPconnector::setState(dfESPabsConnector::state_FINISHED);
+        _started = false;
+        return;
+    }
 
-                    free(buff);
+    if (_source != source_DIR) {
+        //
+        // records are read from the FIFO or the socket until the thread stops
+        //
+        publishStream();
+        dfESPconnector::setState(dfESPabsConnector::state_FINISHED);
+        _started = false;
+        return;
+    }
 
-                    _processedFileList.insert(_workingFileList[i]);
+    while(true) {
+        //
+        // Get the file list to read
+        //
+        if (!getFileList()) {
+            eLOG_ERROR("Connectors0110", (  "Error getting file list" ) ); 
+            error = true;
+            break;
+        }
+        ostringstream oss;
+        oss << "dfESPbfileConnector::publisherThread(): "<< "publishing " << _workingFileList.size() << " files as " << (_publishAsBinary? "binary":"string") << " fields" ;
+        if (_manifestFile.empty()) {
+            eLOG_INFO("Connectors0110", (  oss.str().c_str() ) ); 
+        } else {
+            oss << " from manifest line " << _manifestLine - (int64_t)_workingFileList.size();
+            eLOG_DEBUG("Connectors0110", (  oss.str().c_str() ) ); 
+        }
+        
+        size_t i = 0;
+        if (_resumeFromCheckpoint) {
+            //
+            // resume right after the last file published by the previous active node
+            //
+            _resumeFromCheckpoint = false;
+            for (size_t j = 0; j < _workingFileList.size(); j++) {
+                if (_workingFileList[j].name == _checkpointLastName) {
+                    i = j + 1;
+                    break;
                 }
-                else  {
-                    eLOG_ERROR("Connectors0110", (  "Unable to open file" ) ); 
+            }
+            if (i == 0) {
+                // last file is gone, only publish the files never published
+                _workingFileList.erase(std::remove_if(_workingFileList.begin(), _workingFileList.end(), [this](const bfileEntry_t &entry) {
+                    return _processedFileList.find(entry.name) != _processedFileList.end();
+                }), _workingFileList.end());
+            }
+        }
+        if (!_manifestBatchPending) {
+            // start of a pass, a manifest pass spans several batches
+            _replayAnchorUs = INT64_MIN;
+            _replayDriftCount = 0;
+            _replayDriftSumUs = 0;
+            _replayDriftMaxUs = 0;
+        }
+        
+        while ( i < _workingFileList.size() && 0 == _threadStop.get() ) {
+            
+            if (_replayMode != replay_NONE && !waitReplaySlot(i)) {
+                break;
+            }
+
+            auto retryWait = _workingFileList[i].retryAt - std::chrono::steady_clock::now();
+            if (retryWait > std::chrono::steady_clock::duration::zero()) {
+                // only requeued files are left, the first one is still being written or claimed
+                if (!injectStale()) {
+                    error = true;
+                    break;
                 }
+                std::this_thread::sleep_for(std::min<std::chrono::steady_clock::duration>(retryWait, std::chrono::milliseconds(100)));
+                continue;
+            }
+
+            auto now = std::chrono::system_clock::now();
 
-                frameNumber++;
+            if ( _replayMode != replay_NONE || _publishPeriod == 0 || now - lastTime >= std::chrono::microseconds(_publishPeriod)) {
+                bool retry = false;
+                if (!publishFile(_workingFileList[i], _manifestFile.empty() ? &retry : nullptr)) {
+                    //failed to build event
+                    error = true;
+                    break;
+                }
+                if (retry) {
+                    //
+                    // still being written, or claimed by another instance: try it again after the other files of the pass,
+                    // until probegrace or the claim expires. The list is kept for the next pass, so the file is moved rather than added twice
+                    //
+                    std::rotate(_workingFileList.begin() + i, _workingFileList.begin() + i + 1, _workingFileList.end());
+                    bfileEntry_t &requeued = _workingFileList.back();
+                    requeued.claimPath.clear(); // an expired lease taken over was renamed back to the file
+                    requeued.mtimeUs = INT64_MIN;
+                    requeued.retryAt = std::chrono::steady_clock::now() + std::chrono::milliseconds(100);
+                    continue;
+                }
                 lastTime = now;
                 ++i;
                 
             }
             else {
-                gMilliSleep( _publishPeriod / 10 );
+                _adaptiveRateLimited = true;
+                std::this_thread::sleep_for( std::chrono::microseconds(_publishPeriod / 10) );
             } 
             
         }
 
+        _manifestBatchPending = !_manifestFile.empty() && !_manifestEof;
+        if (_manifestBatchPending && !error && 0 == _threadStop.get()) {
+            continue; // next batch of the same pass
+        }
+        if (!_manifestFile.empty()) {
+            // a repeat pass reads the whole manifest again
+            _manifestLine = 0;
+            _manifestDoneLine = 0;
+            _manifestEof = false;
+            _manifestBatchPending = false;
+        }
+
+        // the last events of the pass do not wait for a full block
+        if (!error && !injectPending()) {
+            error = true;
+        }
+
+        reportDropped(true);
+
+        if (_replayMode != replay_NONE && _replayDriftCount > 0) {
+            ostringstream oss;
+            oss << "dfESPbfileConnector::publisherThread(): replay at " << _replaySpeed << "x, scheduling drift avg "
+                << _replayDriftSumUs / _replayDriftCount << " us, max " << _replayDriftMaxUs << " us over " << _replayDriftCount << " files";
+            eLOG_INFO("Connectors0110", (  oss.str().c_str() ) ); 
+        }
+
         if (_repeatCount < 0) { // endless loop until thread stop
             continue;
         }
@@ -694,6 +2711,7 @@ bool dfESPbfileConnector::callbackFunction(dfESPeventblockPtr eventBlock, dfESPs
 
     int32_t eventCnt = eventBlock->getSize();
     int32_t eventIndx;
+    int64_t receiveUs = _traceFile ? traceNowUs() : 0;
 
     for (eventIndx=0; eventIndx < eventCnt; eventIndx++) {
         dfESPeventPtr event = eventBlock->getData(eventIndx);
@@ -707,7 +2725,6 @@ bool dfESPbfileConnector::callbackFunction(dfESPeventblockPtr eventBlock, dfESPs
         // FIXME is text or binary?
 
 
-        std::vector<unsigned char> *buffV = nullptr;
         char* buff = nullptr;
         size_t buffSize = 0;
         
@@ -722,14 +2739,93 @@ bool dfESPbfileConnector::callbackFunction(dfESPeventblockPtr eventBlock, dfESPs
             buff = event->getStringPtrByIntIndex(_dataFieldIdIO); 
             buffSize = strlen(buff);
         }
-        
+
+        //
+        // sampling, decided before anything is written
+        //
+        _sampledReceived++;
+        if (_sampleEvery > 1 && (_sampledReceived - 1) % _sampleEvery != 0) {
+            _skippedEvery++;
+            continue;
+        }
+        int64_t traceUs[trace_COUNT];
+        if (_traceFile) {
+            for (int32_t t = 0; t < trace_COUNT; t++) {
+                traceUs[t] = (_traceFieldIdx[t] >= 0 && !event->isNullIntID(_traceFieldIdx[t])) ?
+                             *(int64_t *)event->getPtrByIntIndex(_traceFieldIdx[t]) : INT64_MIN;
+            }
+        }
+        if (_keepLastInterval > 0) {
+            // the event block is released after the callback, so the last event is copied
+            int64_t interval = std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count() / _keepLastInterval;
+            if (_held.pending) {
+                if (_held.interval != interval) {
+                    writeHeld();
+                } else {
+                    _skippedInterval++;
+                }
+            }
+            _held.data.assign(buff, buff + buffSize);
+            _held.interval = interval;
+            _held.receiveUs = receiveUs;
+            memcpy(_held.traceUs, traceUs, sizeof(traceUs));
+            _held.pending = true;
+            continue;
+        }
+        writeFrame(buff, buffSize, traceUs, receiveUs);
+    }
+    reportSampling(false);
+   
+    return rc;
+}
+
+void dfESPbfileConnector::writeHeld() {
+    _held.pending = false;
+    writeFrame(_held.data.data(), _held.data.size(), _held.traceUs, _held.receiveUs);
+}
+
+bool dfESPbfileConnector::admitRate(size_t size) {
+    if (_maxEventRate <= 0.0 && _maxByteRate <= 0) {
+        return true;
+    }
+    auto now = std::chrono::steady_clock::now();
+    double elapsed = std::chrono::duration<double>(now - _tokensRefill).count();
+    _tokensRefill = now;
+    if (_maxEventRate > 0.0) {
+        _eventTokens = std::min(_eventTokens + elapsed * _maxEventRate, _maxEventRate > 1.0 ? _maxEventRate : 1.0);
+        if (_eventTokens < 1.0) {
+            _skippedRate++;
+            return false;
+        }
+    }
+    if (_maxByteRate > 0) {
+        // an event larger than the bucket goes through when it is full, and is paid back over time
+        _byteTokens = std::min(_byteTokens + elapsed * _maxByteRate, (double)_maxByteRate);
+        if (_byteTokens <= 0.0) {
+            _skippedBytes++;
+            return false;
+        }
+        _byteTokens -= (double)size;
+    }
+    if (_maxEventRate > 0.0) {
+        _eventTokens -= 1.0;
+    }
+    return true;
+}
+
+void dfESPbfileConnector::writeFrame(const char *buff, size_t buffSize, const int64_t *traceUs, int64_t receiveUs) {
+    if (!admitRate(buffSize)) {
+        return;
+    }
+    if (_outputToShm) {
+        if (!_shmWriter.write(buff, buffSize, _frameNumber)) {
+            ostringstream oss;
+            oss << "Event " << _frameNumber << " of " << buffSize << " bytes does not fit in a shmslotsize slot";
+            eLOG_ERROR("Connectors0110", (  oss.str().c_str() ) ); 
+        }
+    } else {
         string filePath = _outputFilePath.c_str() + to_string(static_cast<long long>(_frameNumber)) + _outputFileExtension.c_str(); 
-#if 0
-        ios_base::openmode mode = std::ofstream::out | std::ofstream::binary ;
-        std::ofstream file (filePath.c_str(), mode);
-        file.write(buff, buffSize);
-        file.close();
-#else        
         FILE* target;
         if (_publishAsBinary) {
             target = fopen(filePath.c_str(), "wb");
@@ -743,25 +2839,56 @@ bool dfESPbfileConnector::callbackFunction(dfESPeventblockPtr eventBlock, dfESPs
             eLOG_ERROR("Connectors0110", (  oss.str().c_str() ) ); 
         } else {
             fwrite(buff, sizeof(char), (int)buffSize, target);
-            //fwrite(buff, sizeof(unsigned char), (int)buffSize, target);
             fclose(target);
         }
-        
-#endif
-        if (buffV) {
-            delete buffV;
-            buff = nullptr;
-        } 
+    }
+    if (_traceFile) {
+        writeTrace(traceUs, receiveUs);
+    }
+    _sampledWritten++;
+    _frameNumber++;
+}
 
-        _frameNumber++;
+void dfESPbfileConnector::reportSampling(bool force) {
+    if (_sampleEvery <= 1 && _maxEventRate <= 0.0 && _maxByteRate <= 0 && _keepLastInterval <= 0) {
+        return;
     }
-   
-    return rc;
+    auto now = std::chrono::steady_clock::now();
+    if (_sampledReceived.load() == _samplingReported || (!force && now - _samplingReportTime < std::chrono::seconds(5))) {
+        return;
+    }
+    _samplingReported = _sampledReceived.load();
+    _samplingReportTime = now;
+    ostringstream oss;
+    oss << "dfESPbfileConnector::reportSampling(): " << _sampledReceived.load() << " events received, " << _sampledWritten.load()
+        << " written, skipped: " << _skippedEvery.load() << " by sampleevery, " << _skippedInterval.load() << " by keeplastinterval, "
+        << _skippedRate.load() << " by maxeventrate, " << _skippedBytes.load() << " by maxbyterate";
+    eLOG_INFO("Connectors0110", (  oss.str().c_str() ) ); 
+}
+
+void dfESPbfileConnector::getSamplingCounters(int64_t &received, int64_t &written, int64_t &skipped) const {
+    received = _sampledReceived.load();
+    written = _sampledWritten.load();
+    skipped = _skippedEvery.load() + _skippedInterval.load() + _skippedRate.load() + _skippedBytes.load();
 }
 
 
 
+void dfESPbfileConnector::writeTrace(const int64_t *traceUs, int64_t receiveUs) {
+    int64_t writtenUs = traceNowUs();
+    fprintf(_traceFile, "%lld", (long long)_frameNumber);
+    for (int32_t t = 0; t < trace_COUNT; t++) {
+        if (traceUs[t] != INT64_MIN) {
+            fprintf(_traceFile, ",%lld", (long long)traceUs[t]);
+        } else {
+            fprintf(_traceFile, ",");
+        }
+    }
+    fprintf(_traceFile, ",%lld,%lld\n", (long long)receiveUs, (long long)writtenUs);
+}
+
 bool dfESPbfileConnector::buildEvent() {
+    // the event block takes ownership of the event, so it cannot be recycled
     dfESPeventPtr event = new dfESPevent();
     dfESPeventcodes::dfESPeventopcodes opcode = _publishwithupsert ?
         dfESPeventcodes::eo_UPSERT : dfESPeventcodes::eo_INSERT;
@@ -777,43 +2904,222 @@ bool dfESPbfileConnector::buildEvent() {
         }
         return false;
     }
+    if (_trans.empty()) {
+        _transOldest = std::chrono::steady_clock::now();
+    }
     _trans.push_back(event);
     if (_trans.size() >= (size_t)_blocksize) {
-        // build and inject event block
-        dfESPeventblockPtr eventBlock =
-            dfESPeventblock::newEventBlock(&_trans,
-                                           (_transactional ? dfESPeventblock::ebt_TRANS :
-                                            dfESPeventblock::ebt_NORMAL));
-        _trans.free();
-        if (!eventBlock) {
-            eLOG_ERROR("Connectors0003", (
-                       "dfESPbfileConnector::buildEvent()",
-                       "dfESPeventblockPtr" ) );
-            if (_errorCallback) {
-                // call application callback
-                _errorCallback(ESP_PUBSUBFAIL_CONNECTORFAIL,
-                               ESP_PUBSUBCODE_NOERROR, _ctx);
-            }
-            return false;
-        } else if (!pubInject(eventBlock)) {
-            eLOG_ERROR("Connectors0015", ( "dfESPbfileConnector::buildEvent()" ) );
-            if (_errorCallback) {
-                // call application callback
-                _errorCallback(ESP_PUBSUBFAIL_CONNECTORFAIL,
-                               ESP_PUBSUBCODE_NOERROR, _ctx);
-            }
-            return false;
+        return injectPending();
+    }
+    return true;
+}
+
+bool dfESPbfileConnector::injectPending() {
+    if (_trans.empty()) {
+        return true;
+    }
+    // build and inject event block
+    dfESPeventblockPtr eventBlock =
+        dfESPeventblock::newEventBlock(&_trans,
+                                       (_transactional ? dfESPeventblock::ebt_TRANS :
+                                        dfESPeventblock::ebt_NORMAL));
+    _trans.free();
+    if (!eventBlock) {
+        eLOG_ERROR("Connectors0003", (
+                   "dfESPbfileConnector::injectPending()",
+                   "dfESPeventblockPtr" ) );
+        if (_errorCallback) {
+            // call application callback
+            _errorCallback(ESP_PUBSUBFAIL_CONNECTORFAIL,
+                           ESP_PUBSUBCODE_NOERROR, _ctx);
+        }
+        return false;
+    }
+    auto injectStart = std::chrono::steady_clock::now();
+    if (!pubInject(eventBlock)) {
+        eLOG_ERROR("Connectors0015", ( "dfESPbfileConnector::injectPending()" ) );
+        if (_errorCallback) {
+            // call application callback
+            _errorCallback(ESP_PUBSUBFAIL_CONNECTORFAIL,
+                           ESP_PUBSUBCODE_NOERROR, _ctx);
         }
+        return false;
+    }
+
+    if (_adaptive) {
+        adaptOperatingPoint(std::chrono::steady_clock::now() - injectStart);
+    }
+    if (!_promotionReported) {
+        // recovery time: from lock acquisition to the first event injected by this node
+        _promotionReported = true;
+        ostringstream oss;
+        oss << "dfESPbfileConnector::injectPending(): first event published "
+            << std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - _promotedAt).count()
+            << " us after promotion";
+        eLOG_INFO("Connectors0110", (  oss.str().c_str() ) ); 
+    }
+    // the events of the block are published, their claims completed and their progress checkpointed
+    _shard.commit();
+    commitCheckpoint();
 
 #if DEBUG_PUBSUBCLIENT
-        eventsInjected += eventBlock->getSize();
+    eventsInjected += eventBlock->getSize();
 #endif
+    return true;
+}
+
+bool dfESPbfileConnector::injectStale() {
+    //
+    // called while the source has nothing to publish: a partial block waits at most one publish period
+    //
+    if (_trans.empty() ||
+        std::chrono::steady_clock::now() - _transOldest < std::chrono::microseconds(_publishPeriod)) {
+        return true;
+    }
+    return injectPending();
+}
+
+void dfESPbfileConnector::adaptOperatingPoint(std::chrono::steady_clock::duration injectLatency) {
+    double latencyMs = std::chrono::duration_cast<std::chrono::microseconds>(injectLatency).count() / 1000.0;
+    // smooth the latency so that a single slow inject does not halve the rate
+    _adaptiveLatencyEwmaMs = (_adaptiveLatencyEwmaMs < 0.0) ? latencyMs : 0.8 * _adaptiveLatencyEwmaMs + 0.2 * latencyMs;
+
+    auto now = std::chrono::steady_clock::now();
+    if (_adaptiveLatencyEwmaMs > _adaptiveLatencyMs) {
+        //
+        // multiplicative decrease, at most once per target latency so that the model gets a chance to drain
+        //
+        if (now - _adaptiveLastDecrease >= std::chrono::microseconds(static_cast<int64_t>(_adaptiveLatencyMs * 1000))) {
+            _publishRate = std::max(_adaptiveMinRate, _publishRate / 2);
+            _blocksize = std::max(_adaptiveMinBlocksize, _blocksize / 2);
+            _adaptiveLastDecrease = now;
+        }
+    } else {
+        //
+        // additive increase: rate first, then block size once the rate is capped
+        //
+        if (_publishRate < _adaptiveMaxRate) {
+            _publishRate = std::min(_adaptiveMaxRate, _publishRate + _adaptiveRateStep);
+        } else if (_adaptiveRateLimited && _blocksize < _adaptiveMaxBlocksize) {
+            // only worth it when events were waiting for their publish slot
+            _blocksize++;
+        }
+    }
+    _adaptiveRateLimited = false;
+    _publishPeriod = static_cast<int64_t>(1000000/_publishRate);
+
+    _opRate.store(_publishRate);
+    _opBlocksize.store(_blocksize);
+    _opLatencyMs.store(_adaptiveLatencyEwmaMs);
+
+    if (now - _adaptiveLastReport >= std::chrono::seconds(5)) {
+        ostringstream oss;
+        oss << "dfESPbfileConnector::adaptOperatingPoint(): rate " << _publishRate << " fps, blocksize " << _blocksize
+            << ", inject latency " << _adaptiveLatencyEwmaMs << " ms (target " << _adaptiveLatencyMs << " ms)";
+        eLOG_INFO("Connectors0110", (  oss.str().c_str() ) ); 
+        _adaptiveLastReport = now;
+    }
+}
+
+void dfESPbfileConnector::getOperatingPoint(double &rate, int32_t &blocksize, double &injectLatencyMs) const {
+    rate = _opRate.load();
+    blocksize = _opBlocksize.load();
+    injectLatencyMs = _opLatencyMs.load();
+}
 
+bool dfESPbfileConnector::waitForPromotion() {
+    if (!_checkpoint.open(_checkpointFile.c_str(), _checkpointInterval)) {
+        ostringstream oss;
+        oss << "ERROR: could not open checkpoint lock: " << _checkpointFile << ".lock " << strerror(errno);
+        eLOG_ERROR("Connectors0110", (  oss.str().c_str() ) ); 
+        return false;
     }
+    auto standbyStart = std::chrono::steady_clock::now();
+    bool standby = false;
+    //
+    // the active node holds the lock until it stops or dies, meanwhile keep the checkpoint warm
+    //
+    bool active = _checkpoint.waitForLock([this, &standby]() {
+        if (!standby) {
+            standby = true;
+            _standby.store(true);
+            eLOG_INFO("Connectors0110", (  "dfESPbfileConnector::waitForPromotion(): another instance is active, running as standby" ) ); 
+        }
+        return 0 == _threadStop.get();
+    });
+    if (!active) {
+        return false;
+    }
+    _promotedAt = std::chrono::steady_clock::now();
+    // read what the previous active node wrote after the last poll
+    if (!_checkpoint.load()) {
+        ostringstream oss;
+        oss << "ERROR: could not read checkpoint: " << _checkpointFile << " " << strerror(errno);
+        eLOG_ERROR("Connectors0110", (  oss.str().c_str() ) ); 
+        return false;
+    }
+    if (!_checkpoint.startJournal()) {
+        ostringstream oss;
+        oss << "ERROR: could not open checkpoint: " << _checkpointFile << " " << strerror(errno);
+        eLOG_ERROR("Connectors0110", (  oss.str().c_str() ) ); 
+        return false;
+    }
+    //
+    // resume where the checkpoint says the previous active node stopped
+    //
+    if (_checkpoint.frameNumber > 0) {
+        _frameNumber = _checkpoint.frameNumber;
+    }
+    if (_checkpoint.repeatCount != INT32_MIN) {
+        _repeatCount = _checkpoint.repeatCount;
+    }
+    if (_checkpoint.manifestLine >= 0) {
+        _manifestLine = _manifestDoneLine = _checkpoint.manifestLine;
+    }
+    _processedFileList.insert(_checkpoint.processed.begin(), _checkpoint.processed.end());
+    _checkpointLastName = _checkpoint.lastName;
+    _followResume = _checkpoint.followed;
+    _standby.store(false);
+    _promotionReported = !standby;
+    _resumeFromCheckpoint = !_checkpointLastName.empty();
+
+    ostringstream oss;
+    oss << "dfESPbfileConnector::waitForPromotion(): " << (standby ? "promoted to active after " : "active after ")
+        << std::chrono::duration_cast<std::chrono::milliseconds>(_promotedAt - standbyStart).count() << " ms, resuming at event ID "
+        << _frameNumber << " with " << _processedFileList.size() << " files already published";
+    eLOG_INFO("Connectors0110", (  oss.str().c_str() ) ); 
     return true;
 }
 
+void dfESPbfileConnector::checkpointProgress(const std::string &name, const bfileFollow_t *followed) {
+    if (!_checkpoint.isJournalOpen()) {
+        return;
+    }
+    if (followed) {
+        _checkpoint.queueFollowed(_frameNumber, (uint64_t)followed->inode, followed->done, name);
+    } else if (!_manifestFile.empty()) {
+        _checkpoint.queueManifest(_frameNumber, _repeatCount, _manifestDoneLine);
+    } else {
+        _checkpoint.queueFile(_frameNumber, _repeatCount, name);
+    }
+    //
+    // a line is only written once its event is injected: a crash before that must not skip the event.
+    // With no pending event, the event was injected with its block, or there was no event to publish
+    //
+    if (_trans.empty()) {
+        commitCheckpoint();
+    }
+}
+
+void dfESPbfileConnector::commitCheckpoint() {
+    if (_checkpoint.hasQueued() && !_checkpoint.commit()) {
+        ostringstream oss;
+        oss << "ERROR: could not write checkpoint: " << _checkpointFile << " " << strerror(errno);
+        eLOG_ERROR("Connectors0110", (  oss.str().c_str() ) ); 
+    }
+}
+
 bool dfESPbfileConnector::isFailoverStandby() {
-    return false;
+    return _standby.load();
 }
 
@@ -28,6 +28,18 @@
 // api includes 
 //
 #include "dfESPconnector.h"
+#include "dfESPbfileCheckpoint.h"
+#include "dfESPbfileRead.h"
+#include "dfESPbfileShard.h"
+#include "dfESPbfileShmRing.h"
+
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <fstream>
+#include <map>
+#include <regex>
+#include <sys/types.h>
 
 
 
@@ -45,10 +57,70 @@ public:
                                                     dfESPstring name,
                                                     dfESPstring xportCfgFile);
 
+    /**
+     * Current operating point of the adaptive publisher, can be called from any thread
+     * @param rate publish rate (frames per second)
+     * @param blocksize number of events per injected event block
+     * @param injectLatencyMs smoothed pubInject latency in milliseconds
+     */
+    DFESPCONP_API void getOperatingPoint(double &rate, int32_t &blocksize, double &injectLatencyMs) const;
+    /**
+     * Files not published because of the freshness policy, can be called from any thread
+     * @param dropped files skipped, older than maxage or superseded
+     * @param archived files moved to archivepath instead of being published
+     * @param superseded part of dropped and archived skipped by freshness=latest for a newer file
+     */
+    DFESPCONP_API void getDropCounters(int64_t &dropped, int64_t &archived, int64_t &superseded) const;
+    /**
+     * Frames rejected by the probe, can be called from any thread
+     */
+    DFESPCONP_API void getProbeCounters(int64_t &truncated, int64_t &malformed, int64_t &wrongSize, int64_t &quarantined) const;
+    /**
+     * Subscriber sampling counters, can be called from any thread
+     * @param received events received
+     * @param written events written to the output
+     * @param skipped events left out by sampleevery, keeplastinterval, maxeventrate or maxbyterate
+     */
+    DFESPCONP_API void getSamplingCounters(int64_t &received, int64_t &written, int64_t &skipped) const;
+
     //
     // Private member functions
     //
 private:
+    /**
+     * A file queued for publishing
+     */
+    struct bfileEntry_t {
+        std::string name;
+        int64_t     timestampUs = 0; // replay timestamp in microseconds
+        int32_t     source      = 0; // index in _sourceDirs
+        int64_t     mtimeUs     = INT64_MIN; // modification time, only set for the freshness policies
+        int64_t     line        = 0; // manifest line number
+        std::string claimPath;       // shardclaim=rename: the expired lease to take over
+        std::string metadata;        // manifest metadata
+        std::chrono::steady_clock::time_point retryAt; // truncated file requeued in the pass: not read again before
+    };
+    enum bfileProbeStatus_t { probe_OK, probe_TRUNCATED, probe_MALFORMED, probe_WRONGSIZE };
+    /**
+     * Image header found by the probe
+     */
+    struct bfileProbe_t {
+        bfileProbeStatus_t status   = probe_MALFORMED;
+        const char        *format   = nullptr; // "jpeg", "png", "wide", nullptr when not recognized
+        int32_t            width    = 0;
+        int32_t            height   = 0;
+        int32_t            channels = 0;
+    };
+    /**
+     * A file followed in follow mode
+     */
+    struct bfileFollow_t {
+        int         fd     = -1;   // kept open so that a rotated file can be finished
+        ino_t       inode  = 0;
+        int64_t     offset = 0;    // bytes already read
+        int64_t     done   = 0;    // bytes published, the checkpointed resume offset
+        std::string carry;         // partial record at the end of the last read
+    };
     /**
      * dfESPbfileConnector constructor
      */
@@ -109,8 +181,206 @@ private:
     void publisherThread();
 
     bool getFileList();
+    /**
+     * Append the matching files of one directory to _workingFileList
+     * @param dirPath directory to scan
+     * @param weight round robin weight of the directory when it is a new source
+     * @param rgx compiled filename_rgx
+     * @param subDirs when not null, the subdirectories found are appended to it
+     * @return bool true = success, false = directory cannot be opened
+     */
+    bool scanDirectory(const std::string &dirPath, int32_t weight, const std::regex &rgx, std::vector<std::string> *subDirs);
+    /**
+     * Order _workingFileList: by timestamp when replaying, else weighted round robin across the source directories
+     */
+    void scheduleFileList();
+    /**
+     * Replace _workingFileList with the next manifestbatch entries of the manifest
+     * @param rgx compiled filename_rgx, only applied when filename_rgx is set
+     * @return bool true = success, false = manifest cannot be opened
+     */
+    bool readManifestBatch(const std::regex &rgx);
+    /**
+     * Read and publish one file of _workingFileList, or drop it when older than maxage
+     * @param entry the file
+     * @param retry when not null, set to true instead of rejecting a truncated file modified within probegrace,
+     *        or instead of waiting for the claim of another instance to complete or expire,
+     *        the file is then neither processed nor claimed and gets no event ID
+     * @return bool true = success, false = failed to build event
+     */
+    bool publishFile(const bfileEntry_t &entry, bool *retry = nullptr);
+    /**
+     * Modification time of a file in microseconds since the epoch, INT64_MIN when it cannot be read
+     */
+    int64_t getMtimeUs(const std::string &fileName);
+    /**
+     * @return bool true = the file is older than maxage
+     */
+    bool isStale(const bfileEntry_t &entry);
+    /**
+     * Drop or archive a file instead of publishing it, and count it
+     * @param entry the file
+     * @param superseded true = skipped for a newer file by freshness=latest
+     */
+    void dropStale(const bfileEntry_t &entry, bool superseded = false);
+    /**
+     * Parse the JPEG, PNG or SAS wide header of a frame with a marker scan, without decoding it
+     * @param data the frame
+     * @param length frame length in bytes
+     * @return bfileProbe_t format, size and whether the frame is complete
+     */
+    bfileProbe_t probeFrame(const unsigned char *data, int64_t length);
+    /**
+     * Count a frame rejected by the probe, and write it to quarantinepath with probe=quarantine
+     */
+    void rejectFrame(const bfileProbe_t &probe, const char *data, int64_t length, const char *name);
+    /**
+     * Log the dropped file counters when they changed, at most every 5 seconds unless forced
+     */
+    void reportDropped(bool force);
+    /**
+     * The publisher loop of freshness=lifo|latest: rescan the directories and publish the newest files first
+     */
+    void publishLive();
+    /**
+     * Compute the replay timestamp of a file from its mtime or from the
+     * filename_rgx capture group selected by replaytsgroup
+     * @param fullName full path of the file
+     * @param match regex match of the file name
+     * @param timestampUs returned timestamp in microseconds
+     * @return bool true = success, false = no usable timestamp
+     */
+    bool getReplayTimestamp(const std::string &fullName, const std::smatch &match, int64_t &timestampUs);
+    /**
+     * Sleep until the replay schedule says file i is due, and record the drift
+     * @param i index of the file in _workingFileList
+     * @return bool true = file is due, false = thread stop requested
+     */
+    bool waitReplaySlot(size_t i);
+
+    /**
+     * Read a whole file into the reusable read buffer _readBuff
+     * @param fileName full path of the file
+     * @param fileSize returned number of bytes read
+     * @return bool true = success, false = failure
+     */
+    bool readFile(const std::string &fileName, int64_t &fileSize);
+    /**
+     * Make sure _readBuff holds at least length bytes plus the ending NULL
+     * @param length number of bytes to read
+     * @return bool true = success, false = allocation failure
+     */
+    bool growReadBuff(size_t length);
+    /**
+     * Build the event of one file or record, with ID _frameNumber
+     * @param data the bytes to publish, within _readBuff since data[length] is overwritten for strings
+     * @param length number of bytes
+     * @param name value of the filename field
+     * @param metadata value of the metadata field
+     * @param retry when not null, set to true instead of rejecting a truncated frame, nothing is built
+     * @return bool true = success, false = failure
+     */
+    bool publishBuffer(char *data, int64_t length, const char *name, const char *metadata = "", bool *retry = nullptr);
+    /**
+     * Open the FIFO, or the listening UNIX socket, named by path
+     * @return int file descriptor, -1 = failure
+     */
+    int openStream();
+    /**
+     * Blocking read of exactly length bytes, woken up every 100ms to check _threadStop
+     * @return int 1 = success, 0 = end of stream before any byte, -1 = error, partial record or thread stop
+     */
+    int readStream(int fd, char *buff, size_t length);
+    /**
+     * The publisher loop of the fifo and socket sources: one event per length-prefixed record
+     */
+    void publishStream();
+    /**
+     * The publisher loop of the follow mode: publish the bytes appended to the matching files
+     */
+    void publishFollow();
+    /**
+     * Publish what was appended to one file since the last call, handling rotation and truncation
+     * @param name full path of the file
+     * @return bool true = success, false = failed to build event
+     */
+    bool followFile(const std::string &name);
+    /**
+     * Read and publish the bytes of a followed file from its offset to its end
+     * @param name full path of the file, published in the filename field
+     * @param followed the file state
+     * @param mtimeUs modification time of the file, for the trace fields
+     * @return bool true = success, false = failed to build event
+     */
+    bool readFollowed(const std::string &name, bfileFollow_t &followed, int64_t mtimeUs);
+    /**
+     * Publish the partial record left at the end of a removed or rotated file
+     * @return bool true = success, false = failed to build event
+     */
+    bool publishCarry(const std::string &name, bfileFollow_t &followed);
+    /**
+     * Become the active publisher: hold the checkpoint lock, or wait as standby while
+     * tailing the checkpoint journal of the active node
+     * @return bool true = active, false = thread stop requested or checkpoint error
+     */
+    bool waitForPromotion();
+    /**
+     * Record the progress after one event in the checkpoint journal, once the event is injected
+     * @param name the published file, empty for streamed records
+     * @param followed in follow mode, the file state holding the bytes published
+     */
+    void checkpointProgress(const std::string &name, const bfileFollow_t *followed = nullptr);
+    /**
+     * Append the checkpoint lines of the events injected so far to the journal
+     */
+    void commitCheckpoint();
+
+    /**
+     * Wall clock time in microseconds, advanced with the monotonic clock so that intervals never go backward
+     */
+    int64_t traceNowUs();
+    /**
+     * Append the latency trace of one written event to the tracefile
+     * @param traceUs the trace fields of the event, INT64_MIN when missing
+     * @param receiveUs time its event block was received
+     */
+    void writeTrace(const int64_t *traceUs, int64_t receiveUs);
+    /**
+     * Write one event to the output file or ring, unless maxeventrate or maxbyterate drops it
+     */
+    void writeFrame(const char *buff, size_t buffSize, const int64_t *traceUs, int64_t receiveUs);
+    /**
+     * Write the event kept for the last keeplastinterval
+     */
+    void writeHeld();
+    /**
+     * Token buckets of maxeventrate and maxbyterate
+     * @param size event size in bytes
+     * @return bool true = the event can be written
+     */
+    bool admitRate(size_t size);
+    /**
+     * Log the sampling counters when they changed, at most every 5 seconds unless forced
+     */
+    void reportSampling(bool force);
 
     bool buildEvent();
+    /**
+     * Build and inject an event block with the pending events, if any
+     * @return bool true = success, false = failed to build or inject the block
+     */
+    bool injectPending();
+    /**
+     * Inject the pending events when the oldest one waited for more than one publish period,
+     * called while the source has nothing new to publish
+     */
+    bool injectStale();
+    /**
+     * AIMD controller of the adaptive mode: back off publishrate and blocksize when
+     * the pubInject latency exceeds adaptivelatency, grow them back otherwise
+     * @param injectLatency duration of the last pubInject call
+     */
+    void adaptOperatingPoint(std::chrono::steady_clock::duration injectLatency);
 
     void freeResources();
 
@@ -132,31 +402,186 @@ public:
 private:
     static dfESPstring bfileSubAnnotationsFormatValues[];
     static dfESPstring bfileSubAnnotationsCoordTypeValues[];
+    static dfESPstring bfilePubReplayValues[];
+    static dfESPstring bfilePubReplayTsUnitValues[];
+    static dfESPstring bfileSubOutputValues[];
+    static dfESPstring bfilePubSourceValues[];
+    static dfESPstring bfilePubFreshnessValues[];
+    static dfESPstring bfilePubStaleActionValues[];
+    static dfESPstring bfilePubShardClaimValues[];
+    static dfESPstring bfilePubProbeValues[];
+    static const char *bfileTraceFieldNames[];
+    static const char *bfileProbeFieldNames[];
     //static dfESPstring bfileSubFileTypeValues[];
     
     int32_t _blocksize;
     bool _transactional;
     dfESPptrVect<dfESPeventPtr> _trans;
+    std::chrono::steady_clock::time_point _transOldest;   // when the first pending event was built
     dfESPptrVect<dfESPdatavarPtr> _dvv;
 
     // Pub 
     dfESPstring _fileNameRgx;
     dfESPstring _filePath;
-    std::vector<std::string> _workingFileList;
+    /**
+     * A directory files are read from, with its round robin weight
+     */
+    struct bfileSourceDir_t {
+        std::string path;
+        int32_t     weight = 1;
+    };
+    std::vector<bfileSourceDir_t> _roots;      // the path list
+    std::vector<bfileSourceDir_t> _sourceDirs; // roots and, when recursive, their subdirectories
+    std::map<std::string, size_t> _sourceIndex;
+    bool _recursive = false;
+
+    // Freshness -- newest files first and drop the stale ones, for live directories
+    enum bfileFreshness_t { fresh_FIFO, fresh_LIFO, fresh_LATEST };
+    bfileFreshness_t _freshness = fresh_FIFO;
+    int64_t _maxAge = 0;               // ms, 0 = files never get stale
+    bool    _staleArchive = false;     // staleaction=archive: move stale files to _archivePath
+    dfESPstring _archivePath;
+    std::atomic<int64_t> _droppedFiles{0};
+    std::atomic<int64_t> _archivedFiles{0};
+    std::atomic<int64_t> _supersededFiles{0};
+    int64_t _droppedReported = 0;
+    std::chrono::steady_clock::time_point _droppedReportTime;
+
+    // Sharding -- several instances reading the same directories
+    dfESPbfileShard _shard;
+    int64_t _claimsLost = 0;
+
+    // Probe -- image headers checked before the event is built
+    enum bfileProbeMode_t { probe_NONE, probe_FILL, probe_REJECT, probe_QUARANTINE };
+    enum { probe_FIELDCOUNT = 3 };     // width, height, channels
+    bfileProbeMode_t _probe = probe_NONE;
+    int32_t _probeFieldIdx[probe_FIELDCOUNT] = {-1, -1, -1};
+    int32_t _formatFieldIdx = -1;
+    int32_t _probeWidth  = 0;          // expected width, 0 = any
+    int32_t _probeHeight = 0;          // expected height, 0 = any
+    dfESPstring _quarantinePath;
+    std::atomic<int64_t> _probeTruncated{0};
+    std::atomic<int64_t> _probeMalformed{0};
+    std::atomic<int64_t> _probeWrongSize{0};
+    std::atomic<int64_t> _probeQuarantined{0};
+    std::atomic<int64_t> _probeRetried{0};
+    int64_t _probeGrace = 10000;       // ms, a truncated file modified more recently is retried
+
+    // Follow -- publish the bytes appended to the files, split on recorddelimiter
+    bool    _follow      = false;
+    std::string _recordDelimiter;      // empty = each read is an event
+    int64_t _followChunk = 1048576;    // bytes read at once
+    int32_t _followPoll  = 1000;       // ms between two full checks
+    std::map<std::string, bfileFollow_t> _followedFiles;
+    std::map<std::string, dfESPbfileCheckpointPos_t> _followResume;   // checkpointed positions of the files not followed yet
+
+    // Manifest -- ordered file list read by batches instead of scanning directories
+    dfESPstring   _manifestFile;
+    std::ifstream _manifest;
+    int64_t _manifestLine     = 0;     // next line to read
+    int64_t _manifestDoneLine = 0;     // line after the last file published, the resume offset
+    int32_t _manifestBatch    = 1000;  // entries read at once
+    bool    _manifestEof      = false;
+    bool    _manifestBatchPending = false;
+    int32_t _metadataFieldIdx = -1;
+    std::vector<bfileEntry_t> _workingFileList;
     std::set<std::string>  _processedFileList;
 
+    // Checkpoint -- progress journal shared with a standby instance, the lock elects the active one
+    dfESPstring _checkpointFile;
+    int32_t _checkpointInterval = 1;   // events between journal flushes
+    dfESPbfileCheckpoint _checkpoint;
+    std::atomic<bool> _standby{false};
+    std::chrono::steady_clock::time_point _promotedAt;
+    bool    _promotionReported  = true;
+    std::string _checkpointLastName;   // last file published according to the checkpoint
+    bool    _resumeFromCheckpoint = false;
+
+    // Stream -- length-prefixed records read from a FIFO or a UNIX socket instead of a directory
+    enum bfileSource_t { source_DIR, source_FIFO, source_SOCKET };
+    bfileSource_t _source = source_DIR;
+    bool    _recordName    = false;    // records carry their name, published in the filename field
+    int64_t _maxRecordSize = 67108864;
+
     bool _publishAsBinary = false;
+    int32_t _fileNameFieldIdx = -1;
+
+    // Trace -- optional int64 schema fields stamped by the publisher, written to tracefile by the subscriber
+    enum bfileTraceField_t { trace_MTIME, trace_READSTART, trace_READEND, trace_INJECT, trace_COUNT };
+    int32_t _traceFieldIdx[trace_COUNT] = {-1, -1, -1, -1};
+    int64_t _traceUs[trace_COUNT]       = {0, 0, 0, 0};
+    int64_t _traceWallUs0 = 0;
+    std::chrono::steady_clock::time_point _traceMono0;
+    FILE   *_traceFile    = nullptr;
+
+    char   *_readBuff     = nullptr; // grow-only buffer reused for every file read
+    size_t  _readBuffSize = 0;
 
     double  _publishRate    = 0.0; // frames per second -- if <= 0 then the max speed is used.
-    int32_t _publishPeriod = 0;   // =1000/_publishRate ms
+    int64_t _publishPeriod = 0;   // =1000000/_publishRate us
     int32_t _repeatCount   = 0;
 
+    // Replay -- pace the files on their recorded inter-arrival times
+    enum bfileReplay_t { replay_NONE, replay_MTIME, replay_FILENAME };
+    bfileReplay_t _replayMode = replay_NONE;
+    double  _replaySpeed   = 1.0;  // 2.0 = twice as fast -- if <= 0 then the max speed is used.
+    int32_t _replayTsGroup = 1;    // filename_rgx capture group holding the timestamp
+    int64_t _replayTsNsPerUnit = 1000000; // nanoseconds per timestamp unit
+    std::chrono::steady_clock::time_point _replayStart;
+    int64_t _replayAnchorUs = INT64_MIN; // timestamp of the first file of the pass
+    int64_t _replayDriftCount = 0;
+    int64_t _replayDriftSumUs = 0;
+    int64_t _replayDriftMaxUs = 0;
+
+    // Adaptive -- AIMD on publishrate and blocksize driven by the pubInject latency
+    bool    _adaptive             = false;
+    double  _adaptiveLatencyMs    = 50.0;  // target pubInject latency
+    double  _adaptiveMinRate      = 1.0;
+    double  _adaptiveMaxRate      = 1000.0;
+    double  _adaptiveRateStep     = 1.0;   // additive increase, frames per second
+    int32_t _adaptiveMinBlocksize = 1;     // = blocksize
+    int32_t _adaptiveMaxBlocksize = 64;
+    bool    _adaptiveRateLimited  = false; // an event waited for its publish slot since the last inject
+    double  _adaptiveLatencyEwmaMs = -1.0;
+    std::chrono::steady_clock::time_point _adaptiveLastDecrease;
+    std::chrono::steady_clock::time_point _adaptiveLastReport;
+    std::atomic<double>  _opRate{0.0};
+    std::atomic<int32_t> _opBlocksize{0};
+    std::atomic<double>  _opLatencyMs{0.0};
+
     // Sub
     dfESPstring _outputFileName;
     dfESPstring _outputFilePath;
     dfESPstring _outputFileExtension;
 
-    int64_t _frameNumber = 1;
+    bool _outputToShm = false;       // output=shm: write each blob into a shared-memory ring
+    dfESPbfileShmWriter _shmWriter;
+
+    // Sampling -- events left out before anything is written
+    int64_t _sampleEvery      = 1;     // write 1 event out of _sampleEvery
+    double  _maxEventRate     = 0.0;   // events/s, 0 = no limit
+    int64_t _maxByteRate      = 0;     // bytes/s, 0 = no limit
+    int64_t _keepLastInterval = 0;     // ms, 0 = write every event
+    double  _eventTokens      = 0.0;
+    double  _byteTokens       = 0.0;
+    std::chrono::steady_clock::time_point _tokensRefill;
+    struct {
+        bool              pending   = false;
+        int64_t           interval  = 0;
+        int64_t           receiveUs = 0;
+        int64_t           traceUs[trace_COUNT];
+        std::vector<char> data;
+    } _held;                           // last event of the current keeplastinterval
+    std::atomic<int64_t> _sampledReceived{0};
+    std::atomic<int64_t> _sampledWritten{0};
+    std::atomic<int64_t> _skippedEvery{0};
+    std::atomic<int64_t> _skippedInterval{0};
+    std::atomic<int64_t> _skippedRate{0};
+    std::atomic<int64_t> _skippedBytes{0};
+    int64_t _samplingReported = 0;
+    std::chrono::steady_clock::time_point _samplingReportTime;
+
+    int64_t _frameNumber = 1;      // next event ID (pub) or output file number (sub)
 
     //dfESPstring _dataFieldName;
     int32_t _dataFieldIdIO = -1;
@@ -0,0 +1,77 @@
+// Copyright © 2021, SAS Institute Inc., Cary, NC, USA.  All Rights Reserved.
+// SPDX-License-Identifier: Apache-2.0
+
+
+// -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 4 -*-
+
+/**
+ * \file dfESPbfileRead.h
+ *
+ * \brief File read path of the bfile publisher.
+ *
+ * Every file is read whole into one grow-only buffer reused for all the files,
+ * so that reading a file allocates nothing once the buffer holds the largest
+ * file. This header has no SAS Event Stream Processing dependency, so that
+ * tools/bfile_alloc_bench measures the allocations of this exact code.
+ */
+
+#ifndef __dfESPbfileRead__
+#define __dfESPbfileRead__
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+
+#include <sys/stat.h>
+
+/**
+ * Make sure buff holds at least length bytes plus an ending NULL, growing it only when needed
+ * @param buff the buffer, reallocated when too small
+ * @param buffSize its size in bytes
+ * @param length number of bytes to hold
+ * @return bool true = success, false = allocation failure (errno is ENOMEM), buff is unchanged
+ */
+inline bool dfESPbfileGrowBuffer(char *&buff, size_t &buffSize, size_t length) {
+    if (length + 1 > buffSize) {
+        char *grown = (char *)realloc(buff, length + 1);
+        if (!grown) {
+            errno = ENOMEM;
+            return false;
+        }
+        buff = grown;
+        buffSize = length + 1;
+    }
+    return true;
+}
+
+/**
+ * Read a whole file into buff
+ * @param fileName path of the file
+ * @param binary true = binary mode
+ * @param buff the buffer, grown with dfESPbfileGrowBuffer()
+ * @param buffSize its size in bytes
+ * @param fileSize returned number of bytes read
+ * @param st returned status of the file
+ * @return bool true = success, false = failure, see errno
+ */
+inline bool dfESPbfileReadFile(const char *fileName, bool binary, char *&buff, size_t &buffSize, int64_t &fileSize, struct stat &st) {
+    FILE *file = fopen(fileName, binary ? "rb" : "r");
+    if (file == nullptr) {
+        return false;
+    }
+    // the whole file is read at once into buff, no need for a stdio buffer
+    setvbuf(file, nullptr, _IONBF, 0);
+
+    if (fstat(fileno(file), &st) != 0 || !dfESPbfileGrowBuffer(buff, buffSize, (size_t)st.st_size)) {
+        int error = errno;
+        fclose(file);
+        errno = error;
+        return false;
+    }
+    fileSize = (int64_t)fread(buff, 1, (size_t)st.st_size, file);
+    fclose(file);
+    return true;
+}
+
+#endif
@@ -0,0 +1,288 @@
+// Copyright © 2021, SAS Institute Inc., Cary, NC, USA.  All Rights Reserved.
+// SPDX-License-Identifier: Apache-2.0
+
+
+// -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 4 -*-
+
+/**
+ * \file dfESPbfileShard.h
+ *
+ * \brief Sharing of one input directory between several bfile publishers.
+ *
+ * A file belongs to the shard given by the jump consistent hash of the FNV-1a
+ * hash of its name. Publishers coming and going can also claim each file
+ * through the filesystem before publishing it:
+ *
+ * - mode_EXCL: the first publisher to create <file>.claim with O_EXCL owns
+ *   the file. Once the file is published the claim is made read-only, which
+ *   marks it done. A claim still writable after leaseTimeoutMs was left by a
+ *   publisher that died: another publisher moves it away and claims the file
+ *   again. The claim of a removed file is removed by the next scan.
+ * - mode_RENAME: the first publisher to rename the file to
+ *   <file>.lease.<node> owns it, and renames it to <file>.done once it is
+ *   published. A lease older than leaseTimeoutMs is taken over by another
+ *   publisher renaming it to its own lease name.
+ *
+ * A publisher slower than leaseTimeoutMs loses its claim, the timeout must
+ * exceed the time to publish a file. This header has no SAS Event Stream
+ * Processing dependency, so that tools/bfile_shard_bench can exercise it.
+ */
+
+#ifndef __dfESPbfileShard__
+#define __dfESPbfileShard__
+
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+/**
+ * \class dfESPbfileShard
+ *
+ * \brief Shard assignment and file claims of one publisher.
+ */
+class dfESPbfileShard {
+public:
+    enum mode_t { mode_NONE, mode_EXCL, mode_RENAME };
+    enum claim_t {
+        claim_OWNED,    // this publisher publishes the file
+        claim_TAKEN,    // published, or being published, by another publisher: skip it for good
+        claim_BUSY,     // mode_EXCL: claimed by another publisher, can be taken over once expired
+        claim_ERROR     // the claim could not be created, see errno
+    };
+
+    int32_t     count          = 1;
+    int32_t     id             = 0;
+    mode_t      mode           = mode_NONE;
+    int64_t     leaseTimeoutMs = 60000;
+    std::string node;                  // <hostname>-<pid>, written in claim and lease names
+    int64_t     takeovers      = 0;    // expired claims and leases taken over
+
+    // FNV-1a, stable across hosts and builds unlike std::hash
+    static uint64_t fnv1a(const std::string &s) {
+        uint64_t h = 14695981039346656037ULL;
+        for (unsigned char c : s) {
+            h ^= c;
+            h *= 1099511628211ULL;
+        }
+        return h;
+    }
+
+    // jump consistent hash (Lamping, Veach): only 1/n of the keys move when going from n-1 to n buckets
+    static int32_t jumpHash(uint64_t key, int32_t buckets) {
+        int64_t b = -1;
+        int64_t j = 0;
+        while (j < buckets) {
+            b = j;
+            key = key * 2862933555777941757ULL + 1;
+            j = (int64_t)((b + 1) * ((double)(1LL << 31) / (double)((key >> 33) + 1)));
+        }
+        return (int32_t)b;
+    }
+
+    /**
+     * @return bool true = the file belongs to this shard
+     * @param fileName file name without its directory
+     */
+    bool owns(const std::string &fileName) const {
+        return count <= 1 || jumpHash(fnv1a(fileName), count) == id;
+    }
+
+    /**
+     * Sort out a directory entry before it is listed for publishing
+     * @param dirPath the directory
+     * @param fileName the entry name, replaced by the name of the file to take over for an expired lease
+     * @param leasePath returned path of the expired lease to take over, empty otherwise
+     * @return bool true = list fileName, false = claim, lease or done file
+     */
+    bool sortEntry(const std::string &dirPath, std::string &fileName, std::string &leasePath) {
+        leasePath.clear();
+        if (mode == mode_EXCL) {
+            if (hasSuffix(fileName, ".claim")) {
+                removeOrphanClaim(dirPath + "/" + fileName);
+                return false;
+            }
+            if (fileName.find(".claim.stale.") != std::string::npos) {
+                // left by a publisher that died during a takeover
+                struct stat st;
+                if (stat((dirPath + "/" + fileName).c_str(), &st) == 0 && isExpired(st)) {
+                    unlink((dirPath + "/" + fileName).c_str());
+                }
+                return false;
+            }
+            return true;
+        }
+        if (mode == mode_RENAME) {
+            if (hasSuffix(fileName, ".done")) {
+                return false;
+            }
+            size_t lease = fileName.rfind(".lease.");
+            if (lease == std::string::npos) {
+                return true;
+            }
+            struct stat st;
+            if (stat((dirPath + "/" + fileName).c_str(), &st) != 0 || !isExpired(st)) {
+                return false;
+            }
+            leasePath = dirPath + "/" + fileName;
+            fileName.erase(lease);
+        }
+        return true;
+    }
+
+    /**
+     * Claim a file before publishing it
+     * @param name full path of the file
+     * @param leasePath with mode_RENAME, the expired lease to take over, empty otherwise
+     * @param readName returned name to read the file from
+     * @return claim_t
+     */
+    claim_t claim(const std::string &name, const std::string &leasePath, std::string &readName) {
+        if (mode == mode_NONE) {
+            readName = name;
+            return claim_OWNED;
+        }
+        if (mode == mode_RENAME) {
+            std::string leaseName = name + ".lease." + node;
+            std::string from = leasePath.empty() ? name : leasePath;
+            if (rename(from.c_str(), leaseName.c_str()) != 0) {
+                return claim_TAKEN;
+            }
+            // rename keeps the modification time, the lease starts now
+            utimes(leaseName.c_str(), NULL);
+            if (!leasePath.empty()) {
+                takeovers++;
+            }
+            readName = leaseName;
+            return claim_OWNED;
+        }
+        std::string claimName = name + ".claim";
+        bool takeover = false;
+        for (int attempt = 0; attempt < 2; attempt++) {
+            int fd = ::open(claimName.c_str(), O_CREAT | O_EXCL | O_WRONLY, 0644);
+            if (fd >= 0) {
+                if (::write(fd, node.c_str(), node.size()) < 0) {
+                    // the claim is the file itself, its content is informational
+                }
+                ::close(fd);
+                takeovers += takeover;
+                readName = name;
+                return claim_OWNED;
+            }
+            if (errno != EEXIST) {
+                return claim_ERROR;
+            }
+            struct stat st;
+            if (stat(claimName.c_str(), &st) != 0) {
+                continue; // released meanwhile
+            }
+            if ((st.st_mode & S_IWUSR) == 0) {
+                return claim_TAKEN;
+            }
+            if (!isExpired(st)) {
+                return claim_BUSY;
+            }
+            //
+            // left by a publisher that died: only one publisher manages to move it away
+            //
+            std::string stale = claimName + ".stale." + node;
+            if (rename(claimName.c_str(), stale.c_str()) != 0) {
+                return claim_BUSY;
+            }
+            if (stat(stale.c_str(), &st) == 0 && ((st.st_mode & S_IWUSR) == 0 || !isExpired(st))) {
+                // completed, or a fresh claim created, since the check: give it back
+                if (link(stale.c_str(), claimName.c_str()) != 0) {
+                    // yet another claim was created meanwhile, it holds the file
+                }
+                unlink(stale.c_str());
+                return claim_BUSY;
+            }
+            unlink(stale.c_str());
+            takeover = true;
+        }
+        return claim_BUSY;
+    }
+
+    /**
+     * Queue the completion of a published file, done by the next commit() once its event is injected:
+     * the claim of a publisher dying before that expires and the file is published by another one
+     */
+    void queueComplete(const std::string &name, const std::string &readName) {
+        _completing.push_back(std::make_pair(name, readName));
+    }
+
+    void commit() {
+        for (const auto &file : _completing) {
+            complete(file.first, file.second);
+        }
+        _completing.clear();
+    }
+
+    /**
+     * The file is published: keep the other publishers off it for good
+     */
+    void complete(const std::string &name, const std::string &readName) {
+        if (mode == mode_EXCL) {
+            chmod((name + ".claim").c_str(), 0444);
+        } else if (mode == mode_RENAME) {
+            rename(readName.c_str(), (name + ".done").c_str());
+        }
+    }
+
+    /**
+     * Give back a claimed file that was not published, to be claimed again later
+     * @param before status of the file before it was claimed, its times are restored
+     */
+    void release(const std::string &name, const std::string &readName, const struct stat &before) {
+        if (mode == mode_EXCL) {
+            unlink((name + ".claim").c_str());
+        } else if (mode == mode_RENAME && rename(readName.c_str(), name.c_str()) == 0) {
+            // give back the modification time the lease refreshed
+            struct timeval times[2];
+            times[0].tv_sec = before.st_atime;
+            times[0].tv_usec = 0;
+            times[1].tv_sec = before.st_mtime;
+            times[1].tv_usec = 0;
+            utimes(name.c_str(), times);
+        }
+    }
+
+private:
+    static bool hasSuffix(const std::string &s, const char *suffix) {
+        size_t length = strlen(suffix);
+        return s.size() > length && s.compare(s.size() - length, length, suffix) == 0;
+    }
+
+    bool isExpired(const struct stat &st) const {
+        int64_t nowUs = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+#if defined(OS_LINUX) || defined(__linux__)
+        int64_t mtimeUs = (int64_t)st.st_mtim.tv_sec * 1000000 + st.st_mtim.tv_nsec / 1000;
+#else
+        int64_t mtimeUs = (int64_t)st.st_mtime * 1000000;
+#endif
+        return nowUs - mtimeUs > leaseTimeoutMs * 1000;
+    }
+
+    // the claim of a removed file, done or expired, is not needed anymore
+    void removeOrphanClaim(const std::string &claimPath) {
+        struct stat st;
+        std::string name = claimPath.substr(0, claimPath.size() - 6);
+        if (stat(name.c_str(), &st) != 0 && errno == ENOENT &&
+            stat(claimPath.c_str(), &st) == 0 && ((st.st_mode & S_IWUSR) == 0 || isExpired(st))) {
+            unlink(claimPath.c_str());
+        }
+    }
+
+    std::vector<std::pair<std::string, std::string>> _completing;  // file and read names of the events not injected yet
+};
+
+#endif
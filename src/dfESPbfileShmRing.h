@@ -0,0 +1,362 @@
+// Copyright © 2021, SAS Institute Inc., Cary, NC, USA.  All Rights Reserved.
+// SPDX-License-Identifier: Apache-2.0
+
+
+// -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 4 -*-
+
+/**
+ * \file dfESPbfileShmRing.h
+ *
+ * \brief Shared-memory ring buffer written by the bfile subscriber.
+ *
+ * A single producer (the bfile subscriber with output=shm) writes each blob
+ * into the next slot of a POSIX shared-memory ring. Any number of co-located
+ * readers can consume the frames without filesystem I/O. This header has no
+ * SAS Event Stream Processing dependency so that readers can include it
+ * directly, C++11 and -lrt (older glibc) are the only requirements.
+ *
+ * Layout: a dfESPbfileShmHeader_t followed by slotCount slots, each slot
+ * being a dfESPbfileShmSlot_t followed by slotSize bytes of data.
+ * Record n (0 based) goes to slot n % slotCount. Each slot is guarded by a
+ * sequence lock: the writer sets slot.seq to 2n+1 while copying and to 2n+2
+ * once the record is complete, then publishes writeSeq = n+1. A reader that
+ * falls more than slotCount records behind detects the overrun and skips the
+ * lost records.
+ *
+ * Reader usage:
+ * \code
+ *     dfESPbfileShmReader reader;
+ *     if (reader.open("/bfile_frames")) {
+ *         std::vector<char> frame(reader.slotSize());
+ *         uint64_t length, lost;
+ *         int64_t id;
+ *         for (;;) {
+ *             int rc = reader.read(frame.data(), frame.size(), length, id, lost);
+ *             if (rc == dfESPbfileShmReader::read_OK) {
+ *                 // lost > 0 means some frames were overwritten before being read
+ *             } else if (rc == dfESPbfileShmReader::read_EMPTY) {
+ *                 usleep(1000);
+ *             } else if (rc == dfESPbfileShmReader::read_CLOSED) {
+ *                 break; // the subscriber stopped, open() again to reattach
+ *             }
+ *         }
+ *     }
+ * \endcode
+ */
+
+#ifndef __dfESPbfileShmRing__
+#define __dfESPbfileShmRing__
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <type_traits>
+
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define BFILE_SHM_MAGIC   0x52494c4946424553ULL // "SEBFILIR"
+#define BFILE_SHM_VERSION 1
+#define BFILE_SHM_ALIGN   64
+
+/**
+ * Ring header, at offset 0 of the shared memory object
+ */
+struct dfESPbfileShmHeader_t {
+    std::atomic<uint64_t> magic;     // set last by the writer, once the ring is initialized
+    uint32_t              version;
+    uint32_t              slotCount;
+    uint64_t              slotSize;  // maximum record length
+    uint64_t              slotStride;
+    std::atomic<uint32_t> closed;    // 1 when the writer has stopped
+    std::atomic<uint64_t> writeSeq;  // number of complete records written so far
+};
+
+/**
+ * Slot header, followed by slotSize bytes of data
+ */
+struct dfESPbfileShmSlot_t {
+    std::atomic<uint64_t> seq;       // 2n+1 while record n is written, 2n+2 once complete
+    uint64_t              length;
+    int64_t               id;        // subscriber frame number
+};
+
+// the ring is shared with other processes: the atomics must not hide a lock and the layout must be plain
+static_assert(ATOMIC_INT_LOCK_FREE == 2 && ATOMIC_LLONG_LOCK_FREE == 2, "the shared memory ring needs lock-free atomics");
+static_assert(sizeof(std::atomic<uint64_t>) == sizeof(uint64_t) && sizeof(std::atomic<uint32_t>) == sizeof(uint32_t),
+              "the shared memory ring needs atomics of the size of their value");
+static_assert(std::is_standard_layout<dfESPbfileShmHeader_t>::value && std::is_standard_layout<dfESPbfileShmSlot_t>::value,
+              "the shared memory ring headers must be standard-layout");
+
+inline size_t dfESPbfileShmAlign(size_t size) {
+    return (size + BFILE_SHM_ALIGN - 1) / BFILE_SHM_ALIGN * BFILE_SHM_ALIGN;
+}
+
+/**
+ * \class dfESPbfileShmWriter
+ *
+ * \brief Single producer side of the ring, used by the bfile subscriber.
+ */
+class dfESPbfileShmWriter {
+public:
+    dfESPbfileShmWriter() {}
+    ~dfESPbfileShmWriter() { close(); }
+
+    /**
+     * Create (or recreate) the shared memory object and initialize the ring
+     * @param name POSIX shared memory name, e.g. "/bfile_frames"
+     * @param slotCount number of slots in the ring
+     * @param slotSize maximum record length in bytes
+     * @return bool true = success, false = failure, see errno
+     */
+    bool open(const std::string &name, uint32_t slotCount, uint64_t slotSize) {
+        close();
+        if (slotCount == 0 || slotSize == 0) {
+            return false;
+        }
+        // readers still attached to a previous ring keep their mapping until they reattach
+        shm_unlink(name.c_str());
+        // readers only need read access, other users must not be able to corrupt the ring
+        int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+        if (fd < 0) {
+            return false;
+        }
+        size_t stride = dfESPbfileShmAlign(sizeof(dfESPbfileShmSlot_t) + slotSize);
+        size_t size = dfESPbfileShmAlign(sizeof(dfESPbfileShmHeader_t)) + stride * slotCount;
+        // allocate every page now: the object is sparse after ftruncate, and a ring larger than
+        // /dev/shm would only fail with SIGBUS on the first write to a missing page
+        int rc = ftruncate(fd, (off_t)size) != 0 ? errno : posix_fallocate(fd, 0, (off_t)size);
+        if (rc != 0) {
+            ::close(fd);
+            shm_unlink(name.c_str());
+            errno = rc;
+            return false;
+        }
+        void *base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (base == MAP_FAILED) {
+            shm_unlink(name.c_str());
+            return false;
+        }
+        // the new object is zero-filled, so all slot sequences start at 0
+        _base = (char *)base;
+        _size = size;
+        _header = (dfESPbfileShmHeader_t *)_base;
+        _header->version = BFILE_SHM_VERSION;
+        _header->slotCount = slotCount;
+        _header->slotSize = slotSize;
+        _header->slotStride = stride;
+        _header->closed.store(0, std::memory_order_relaxed);
+        _header->writeSeq.store(0, std::memory_order_relaxed);
+        _header->magic.store(BFILE_SHM_MAGIC, std::memory_order_release);
+        _seq = 0;
+        return true;
+    }
+
+    /**
+     * Write one record into the next slot, overwriting the oldest record
+     * @param data record bytes
+     * @param length record length, must not exceed the slot size
+     * @param id frame number stored along the record
+     * @return bool true = success, false = ring not open or record too large
+     */
+    bool write(const void *data, uint64_t length, int64_t id) {
+        if (!_header || length > _header->slotSize) {
+            return false;
+        }
+        dfESPbfileShmSlot_t *slot = (dfESPbfileShmSlot_t *)(_base + dfESPbfileShmAlign(sizeof(dfESPbfileShmHeader_t)) +
+                                                            _header->slotStride * (_seq % _header->slotCount));
+        slot->seq.store(2 * _seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        slot->length = length;
+        slot->id = id;
+        memcpy((char *)slot + sizeof(dfESPbfileShmSlot_t), data, length);
+        slot->seq.store(2 * _seq + 2, std::memory_order_release);
+        _seq++;
+        _header->writeSeq.store(_seq, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * Mark the ring closed for the readers and unmap it. The object is never unlinked, so that
+     * readers can still drain it: it keeps up to slotCount * slotSize bytes in /dev/shm until
+     * the next open() with the same name or an explicit shm_unlink()
+     */
+    void close() {
+        if (_header) {
+            _header->closed.store(1, std::memory_order_release);
+            munmap(_base, _size);
+            _header = nullptr;
+            _base = nullptr;
+            _size = 0;
+        }
+    }
+
+    uint64_t sequence() const { return _seq; }
+
+private:
+    char                  *_base   = nullptr;
+    size_t                 _size   = 0;
+    dfESPbfileShmHeader_t *_header = nullptr;
+    uint64_t               _seq    = 0;
+};
+
+/**
+ * \class dfESPbfileShmReader
+ *
+ * \brief Consumer side of the ring, for co-located processes.
+ */
+class dfESPbfileShmReader {
+public:
+    enum readStatus_t {
+        read_OK,        // a record was copied
+        read_EMPTY,     // no new record yet
+        read_CLOSED,    // no new record and the writer has stopped
+        read_TOOSMALL,  // the caller buffer is smaller than the record
+        read_NOTOPEN
+    };
+
+    dfESPbfileShmReader() {}
+    ~dfESPbfileShmReader() { close(); }
+
+    /**
+     * Attach to a ring created by the bfile subscriber, starting at the oldest record still available
+     * @param name POSIX shared memory name used by the subscriber shmname property
+     * @param fromLatest true to skip the records already in the ring
+     * @return bool true = success, false = ring missing or not initialized yet
+     */
+    bool open(const std::string &name, bool fromLatest = false) {
+        close();
+        int fd = shm_open(name.c_str(), O_RDONLY, 0);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(dfESPbfileShmHeader_t)) {
+            ::close(fd);
+            return false;
+        }
+        void *base = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (base == MAP_FAILED) {
+            return false;
+        }
+        _base = (const char *)base;
+        _size = (size_t)st.st_size;
+        _header = (const dfESPbfileShmHeader_t *)_base;
+        if (_header->magic.load(std::memory_order_acquire) != BFILE_SHM_MAGIC ||
+            _header->version != BFILE_SHM_VERSION) {
+            close();
+            return false;
+        }
+        //
+        // never trust the geometry: every slot must fit in the mapping
+        //
+        size_t headerSize = dfESPbfileShmAlign(sizeof(dfESPbfileShmHeader_t));
+        uint64_t slotCount = _header->slotCount;
+        uint64_t slotSize = _header->slotSize;
+        uint64_t slotStride = _header->slotStride;
+        if (slotCount == 0 || slotSize > _size ||
+            slotStride < sizeof(dfESPbfileShmSlot_t) + slotSize ||
+            slotStride > (_size - headerSize) / slotCount) {
+            close();
+            return false;
+        }
+        _slotCount = slotCount;
+        _slotSize = slotSize;
+        _slotStride = slotStride;
+        uint64_t writeSeq = _header->writeSeq.load(std::memory_order_acquire);
+        if (fromLatest) {
+            _seq = writeSeq;
+        } else {
+            _seq = writeSeq > _slotCount ? writeSeq - _slotCount : 0;
+        }
+        return true;
+    }
+
+    /**
+     * Copy the next record
+     * @param buffer destination, at least slotSize() bytes to never get read_TOOSMALL
+     * @param bufferSize size of buffer
+     * @param length returned record length
+     * @param id returned subscriber frame number
+     * @param lost returned number of records overwritten before they could be read
+     * @return readStatus_t
+     */
+    int read(void *buffer, uint64_t bufferSize, uint64_t &length, int64_t &id, uint64_t &lost) {
+        lost = 0;
+        if (!_header) {
+            return read_NOTOPEN;
+        }
+        for (;;) {
+            uint64_t writeSeq = _header->writeSeq.load(std::memory_order_acquire);
+            if (_seq >= writeSeq) {
+                return _header->closed.load(std::memory_order_acquire) ? read_CLOSED : read_EMPTY;
+            }
+            if (writeSeq - _seq > _slotCount) {
+                // overrun: the writer lapped this reader
+                lost += writeSeq - _slotCount - _seq;
+                _seq = writeSeq - _slotCount;
+            }
+            const dfESPbfileShmSlot_t *slot = (const dfESPbfileShmSlot_t *)(_base + dfESPbfileShmAlign(sizeof(dfESPbfileShmHeader_t)) +
+                                                                            _slotStride * (_seq % _slotCount));
+            uint64_t before = slot->seq.load(std::memory_order_acquire);
+            if (before != 2 * _seq + 2) {
+                // overwritten since writeSeq was read, try again from the new position
+                lost++;
+                _seq++;
+                continue;
+            }
+            length = slot->length;
+            id = slot->id;
+            if (length > _slotSize) {
+                // torn or corrupted slot header
+                lost++;
+                _seq++;
+                continue;
+            }
+            if (length > bufferSize) {
+                return read_TOOSMALL;
+            }
+            memcpy(buffer, (const char *)slot + sizeof(dfESPbfileShmSlot_t), length);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            uint64_t after = slot->seq.load(std::memory_order_relaxed);
+            if (after != before) {
+                // overwritten while copying
+                lost++;
+                _seq++;
+                continue;
+            }
+            _seq++;
+            return read_OK;
+        }
+    }
+
+    void close() {
+        if (_base) {
+            munmap((void *)_base, _size);
+            _base = nullptr;
+            _header = nullptr;
+            _size = 0;
+        }
+    }
+
+    uint64_t slotSize() const { return _header ? _slotSize : 0; }
+    uint64_t sequence() const { return _seq; }
+
+private:
+    const char                  *_base       = nullptr;
+    size_t                       _size       = 0;
+    const dfESPbfileShmHeader_t *_header     = nullptr;
+    uint64_t                     _seq        = 0;
+    // geometry validated by open(), the header stays writable by its owner
+    uint64_t                     _slotCount  = 0;
+    uint64_t                     _slotSize   = 0;
+    uint64_t                     _slotStride = 0;
+};
+
+#endif
@@ -0,0 +1,156 @@
+// Copyright © 2021, SAS Institute Inc., Cary, NC, USA.  All Rights Reserved.
+// SPDX-License-Identifier: Apache-2.0
+
+
+// -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 4 -*-
+
+//
+// Heap allocations of the bfile publisher file read path.
+//
+// usage: bfile_alloc_bench <directory> [passes]
+//
+// Reads every regular file of the directory with the read path of the
+// original publisher (one std::ifstream and one malloc'ed buffer per file)
+// and with the current one, dfESPbfileReadFile() of src/dfESPbfileRead.h,
+// the function the connector calls. Prints the number of heap allocations
+// per file read of each. Every malloc, calloc and realloc of the process is
+// counted, including the ones made inside libstdc++ and stdio (operator new,
+// filebuf and FILE buffers).
+//
+// This is the file read only, not the whole per-event path: the dfESPevent
+// that buildEvent() allocates for each event (the event block takes
+// ownership of it) and the blob built and copied into the datavar by
+// publishBuffer() are allocated by the ESP libraries, they are unchanged and
+// cannot be measured without them. glibc only (__libc_malloc).
+//
+
+#include "../src/dfESPbfileRead.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+extern "C" void *__libc_malloc(size_t size);
+extern "C" void *__libc_calloc(size_t count, size_t size);
+extern "C" void *__libc_realloc(void *ptr, size_t size);
+extern "C" void  __libc_free(void *ptr);
+
+static bool    counting = false;
+static int64_t allocations = 0;
+
+extern "C" void *malloc(size_t size) {
+    if (counting) {
+        allocations++;
+    }
+    return __libc_malloc(size);
+}
+
+extern "C" void *calloc(size_t count, size_t size) {
+    if (counting) {
+        allocations++;
+    }
+    return __libc_calloc(count, size);
+}
+
+extern "C" void *realloc(void *ptr, size_t size) {
+    if (counting) {
+        allocations++;
+    }
+    return __libc_realloc(ptr, size);
+}
+
+extern "C" void free(void *ptr) {
+    __libc_free(ptr);
+}
+
+// original publisherThread() read path
+static int64_t readBaseline(const string &name, bool binary) {
+    ios_base::openmode mode = binary ? (ios::in|ios::binary|ios::ate) : (ios::in|ios::ate);
+    std::ifstream file (name.c_str(), mode);
+    if (!file.is_open()) {
+        return -1;
+    }
+    std::streampos fileSize = file.tellg();
+    char *buff = (char*)malloc((int64_t)fileSize + 1);
+    file.seekg(0, ios::beg);
+    file.read(buff, fileSize);
+    file.close();
+    buff[fileSize] = '\0';
+    free(buff);
+    return (int64_t)fileSize;
+}
+
+// dfESPbfileConnector::readFile()
+static char  *readBuff = nullptr;
+static size_t readBuffSize = 0;
+
+static int64_t readCurrent(const string &name, bool binary) {
+    int64_t fileSize = 0;
+    struct stat st;
+    if (!dfESPbfileReadFile(name.c_str(), binary, readBuff, readBuffSize, fileSize, st)) {
+        return -1;
+    }
+    readBuff[fileSize] = '\0';
+    return fileSize;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2 || argc > 3) {
+        cerr << "usage: " << argv[0] << " <directory> [passes]" << endl;
+        return 2;
+    }
+    int passes = argc == 3 ? atoi(argv[2]) : 1;
+    vector<string> files;
+    DIR *dir = opendir(argv[1]);
+    if (dir == nullptr) {
+        cerr << "could not open " << argv[1] << endl;
+        return 1;
+    }
+    struct dirent *ent;
+    while ((ent = readdir(dir)) != nullptr) {
+        string name = string(argv[1]) + "/" + ent->d_name;
+        struct stat st;
+        if (stat(name.c_str(), &st) == 0 && S_ISREG(st.st_mode)) {
+            files.push_back(name);
+        }
+    }
+    closedir(dir);
+    if (files.empty() || passes < 1) {
+        cerr << "no files to read" << endl;
+        return 1;
+    }
+
+    struct path_t {
+        const char *name;
+        int64_t (*read)(const string &, bool);
+    } paths[] = {
+        {"baseline", readBaseline},
+        {"current",  readCurrent},
+    };
+    printf("%zu files, %d passes\n", files.size(), passes);
+    printf("%-10s %-6s %12s %14s\n", "path", "mode", "allocations", "per file read");
+    for (const path_t &path : paths) {
+        for (int binary = 1; binary >= 0; binary--) {
+            allocations = 0;
+            counting = true;
+            for (int p = 0; p < passes; p++) {
+                for (const string &name : files) {
+                    path.read(name, binary != 0);
+                }
+            }
+            counting = false;
+            printf("%-10s %-6s %12lld %14.3f\n", path.name, binary ? "binary" : "string",
+                   (long long)allocations, (double)allocations / (files.size() * passes));
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,314 @@
+// Copyright © 2021, SAS Institute Inc., Cary, NC, USA.  All Rights Reserved.
+// SPDX-License-Identifier: Apache-2.0
+
+
+// -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 4 -*-
+
+//
+// Checkpoint round trip and failover time of the bfile publisher.
+//
+// usage: bfile_failover_bench <work directory> [events] [rate] [blocksize]
+//
+// First checks that the journal read by a standby matches the state of the
+// writer: incremental reads, partial lines, queued lines not committed yet,
+// compaction and manifest lines. Then runs two publisher processes on one
+// checkpoint file in the work directory, with the election and journal code of
+// the connector (src/dfESPbfileCheckpoint.h): the active one publishes events
+// at rate per second, committing their lines every blocksize events like an
+// injected event block, the other one waits as standby. The active one is
+// killed with SIGKILL halfway, and the tool reports the time from the kill to
+// the promotion of the standby and to its first committed event, and checks
+// that every event was checkpointed. The ESP server is not involved: the time
+// to inject the first block after a promotion comes on top.
+//
+// Exit status 0 when every check passed.
+//
+
+#include "../src/dfESPbfileCheckpoint.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <string>
+
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace std;
+
+static int failures = 0;
+
+static void check(bool ok, const char *what) {
+    if (!ok) {
+        printf("FAILED: %s\n", what);
+        failures++;
+    }
+}
+
+static int64_t monoNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static bool sameState(const dfESPbfileCheckpoint &a, const dfESPbfileCheckpoint &b) {
+    if (a.frameNumber != b.frameNumber || a.repeatCount != b.repeatCount || a.manifestLine != b.manifestLine ||
+        a.lastName != b.lastName || a.processed != b.processed || a.followed.size() != b.followed.size()) {
+        return false;
+    }
+    for (const auto &pos : a.followed) {
+        auto other = b.followed.find(pos.first);
+        if (other == b.followed.end() || other->second.inode != pos.second.inode || other->second.done != pos.second.done) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void appendRaw(const string &path, const char *text) {
+    FILE *file = fopen(path.c_str(), "a");
+    if (file) {
+        fputs(text, file);
+        fclose(file);
+    }
+}
+
+//
+// writer and standby in one process, the standby never takes the lock
+//
+static void roundTrip(const string &dir) {
+    string path = dir + "/roundtrip.ckpt";
+    unlink(path.c_str());
+    dfESPbfileCheckpoint writer;
+    dfESPbfileCheckpoint reader;
+    check(writer.open(path, 1) && writer.waitForLock([]() { return false; }), "writer takes the lock");
+    check(reader.open(path, 1) && !reader.waitForLock([]() { return false; }), "reader cannot take the lock");
+    check(writer.load() && writer.startJournal(), "writer opens the journal");
+
+    //
+    // repeat passes over the same files, and followed files, until the journal is compacted at least once
+    //
+    int64_t frame = 1;
+    int64_t compactions = 0;
+    int64_t lines = 0;
+    for (int32_t repeat = 3; repeat >= 0; repeat--) {
+        for (int f = 0; f < 600; f++) {
+            frame++;
+            writer.queueFile(frame, repeat, "/in/img" + to_string(f) + ".jpg");
+            if (f % 50 == 0) {
+                writer.queueFollowed(frame, 1000 + f % 3, f * 10, "/in/log" + to_string(f % 3) + ".txt");
+            }
+            if (f % 8 == 7) {
+                // a block of 8 events is injected
+                writer.commit();
+                compactions += writer.lines() < lines;
+                lines = writer.lines();
+                reader.load();
+            }
+        }
+    }
+    writer.commit();
+    compactions += writer.lines() < lines;
+    check(reader.load() && sameState(reader, writer), "standby state matches the writer across compactions");
+    check(compactions > 0, "the journal was compacted");
+    dfESPbfileCheckpoint fresh;
+    check(fresh.open(path, 1) && fresh.load() && sameState(fresh, writer), "a fresh reader matches the writer");
+
+    //
+    // queued lines are not in the journal until their block is injected
+    //
+    writer.queueFile(frame + 1, 0, "/in/pending.jpg");
+    reader.load();
+    check(reader.processed.count("/in/pending.jpg") == 0 && reader.frameNumber == frame, "queued line not visible before commit");
+    writer.commit();
+    reader.load();
+    check(reader.lastName == "/in/pending.jpg" && reader.frameNumber == frame + 1, "queued line visible after commit");
+    frame++;
+
+    //
+    // a line is applied only once complete
+    //
+    writer.close();
+    appendRaw(path, ("p\t" + to_string(frame + 1) + "\t0\t/in/part").c_str());
+    reader.load();
+    check(reader.lastName == "/in/pending.jpg", "partial line not applied");
+    appendRaw(path, "ial.jpg\n");
+    reader.load();
+    check(reader.lastName == "/in/partial.jpg" && reader.frameNumber == frame + 1, "line applied once complete");
+
+    //
+    // manifest progress survives a compaction
+    //
+    string manifestPath = dir + "/manifest.ckpt";
+    unlink(manifestPath.c_str());
+    dfESPbfileCheckpoint manifest;
+    check(manifest.open(manifestPath, 4) && manifest.waitForLock([]() { return false; }) && manifest.load() &&
+          manifest.startJournal(), "manifest writer opens the journal");
+    for (int64_t line = 1; line <= 100; line++) {
+        manifest.queueManifest(line + 1, 2, line);
+        manifest.commit();
+    }
+    check(manifest.compact(), "manifest journal compacted");
+    dfESPbfileCheckpoint manifestReader;
+    check(manifestReader.open(manifestPath, 1) && manifestReader.load() && manifestReader.manifestLine == 100 &&
+          manifestReader.frameNumber == 101 && manifestReader.repeatCount == 2, "manifest position restored after compaction");
+
+    unlink(path.c_str());
+    unlink((path + ".lock").c_str());
+    unlink(manifestPath.c_str());
+    unlink((manifestPath + ".lock").c_str());
+    printf("round trip: %s\n", failures == 0 ? "ok" : "FAILED");
+}
+
+//
+// one publisher process: standby until it gets the lock, then publishes up to events events
+//
+static void publisher(const string &path, int64_t events, double rate, int32_t blocksize, int reportFd) {
+    dfESPbfileCheckpoint checkpoint;
+    if (!checkpoint.open(path, 1)) {
+        _exit(2);
+    }
+    bool standby = false;
+    checkpoint.waitForLock([&]() {
+        if (!standby) {
+            standby = true;
+            dprintf(reportFd, "standby %d\n", (int)getpid());
+        }
+        return true;
+    });
+    int64_t promotedNs = monoNs();
+    if (!checkpoint.load() || !checkpoint.startJournal()) {
+        _exit(2);
+    }
+    int64_t frame = checkpoint.frameNumber > 0 ? checkpoint.frameNumber : 1;
+    dprintf(reportFd, "promoted %d %lld %lld\n", (int)getpid(), (long long)promotedNs, (long long)frame);
+    bool first = true;
+    int32_t queued = 0;
+    while (frame <= events) {
+        // the event ID is the frame number, the file name follows it
+        checkpoint.queueFile(frame + 1, 0, "/in/img" + to_string(frame) + ".jpg");
+        frame++;
+        if (++queued >= blocksize || frame > events) {
+            checkpoint.commit();
+            queued = 0;
+            if (first) {
+                first = false;
+                dprintf(reportFd, "first %d %lld\n", (int)getpid(), (long long)monoNs());
+            }
+        }
+        if (rate > 0.0) {
+            usleep((useconds_t)(1000000 / rate));
+        }
+    }
+    checkpoint.close();
+    _exit(0);
+}
+
+static bool readReport(FILE *reports, const char *expected, int pid, int64_t &ns, int64_t &frame) {
+    char line[256];
+    while (fgets(line, sizeof(line), reports)) {
+        char type[32];
+        int from = 0;
+        long long a = 0;
+        long long b = 0;
+        if (sscanf(line, "%31s %d %lld %lld", type, &from, &a, &b) >= 2 && strcmp(type, expected) == 0 && (pid == 0 || from == pid)) {
+            ns = a;
+            frame = b;
+            return true;
+        }
+    }
+    return false;
+}
+
+static void failover(const string &dir, int64_t events, double rate, int32_t blocksize) {
+    string path = dir + "/failover.ckpt";
+    unlink(path.c_str());
+    int fds[2];
+    if (pipe(fds) != 0) {
+        check(false, "pipe");
+        return;
+    }
+    pid_t active = fork();
+    if (active == 0) {
+        ::close(fds[0]);
+        publisher(path, events, rate, blocksize, fds[1]);
+    }
+    FILE *reports = fdopen(fds[0], "r");
+    int64_t ns = 0;
+    int64_t frame = 0;
+    check(readReport(reports, "promoted", active, ns, frame), "first instance becomes active");
+    pid_t standby = fork();
+    if (standby == 0) {
+        fclose(reports);
+        publisher(path, events, rate, blocksize, fds[1]);
+    }
+    ::close(fds[1]);
+    check(readReport(reports, "standby", standby, ns, frame), "second instance runs as standby");
+
+    //
+    // kill the active instance halfway
+    //
+    dfESPbfileCheckpoint progress;
+    progress.open(path, 1);
+    while (progress.load() && progress.frameNumber < events / 2) {
+        usleep(1000);
+    }
+    int64_t killedAtFrame = progress.frameNumber;
+    int64_t killNs = monoNs();
+    kill(active, SIGKILL);
+    waitpid(active, NULL, 0);
+
+    int64_t promotedNs = 0;
+    int64_t resumeFrame = 0;
+    int64_t firstNs = 0;
+    bool promoted = readReport(reports, "promoted", standby, promotedNs, resumeFrame);
+    bool published = promoted && readReport(reports, "first", standby, firstNs, frame);
+    check(promoted, "standby promoted");
+    check(published, "promoted instance publishes");
+    int status = 0;
+    waitpid(standby, &status, 0);
+    fclose(reports);
+    check(WIFEXITED(status) && WEXITSTATUS(status) == 0, "promoted instance completes");
+
+    //
+    // every event checkpointed, once the journal is read from scratch
+    //
+    dfESPbfileCheckpoint result;
+    check(result.open(path, 1) && result.load(), "journal readable");
+    bool complete = result.frameNumber == events + 1 && (int64_t)result.processed.size() == events;
+    for (int64_t e = 1; complete && e <= events; e++) {
+        complete = result.processed.count("/in/img" + to_string(e) + ".jpg") == 1;
+    }
+    check(complete, "every event checkpointed");
+    check(resumeFrame >= killedAtFrame, "standby resumes after the progress seen before the kill");
+
+    if (promoted && published) {
+        printf("failover: %lld events at %g/s, blocksize %d, killed at event ID %lld, resumed at event ID %lld\n",
+               (long long)events, rate, blocksize, (long long)killedAtFrame, (long long)resumeFrame);
+        printf("%-24s %10.3f ms\n", "kill to promotion", (promotedNs - killNs) / 1e6);
+        printf("%-24s %10.3f ms\n", "promotion to first event", (firstNs - promotedNs) / 1e6);
+        printf("%-24s %10.3f ms\n", "kill to first event", (firstNs - killNs) / 1e6);
+    }
+    unlink(path.c_str());
+    unlink((path + ".lock").c_str());
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2 || argc > 5) {
+        fprintf(stderr, "usage: %s <work directory> [events] [rate] [blocksize]\n", argv[0]);
+        return 2;
+    }
+    string dir = argv[1];
+    int64_t events = argc > 2 ? atoll(argv[2]) : 2000;
+    double rate = argc > 3 ? atof(argv[3]) : 1000.0;
+    int32_t blocksize = argc > 4 ? atoi(argv[4]) : 1;
+    if (events < 2 || blocksize < 1) {
+        fprintf(stderr, "events must be at least 2 and blocksize at least 1\n");
+        return 2;
+    }
+    roundTrip(dir);
+    failover(dir, events, rate, blocksize);
+    return failures == 0 ? 0 : 1;
+}
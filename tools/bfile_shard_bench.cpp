@@ -0,0 +1,311 @@
+// Copyright © 2021, SAS Institute Inc., Cary, NC, USA.  All Rights Reserved.
+// SPDX-License-Identifier: Apache-2.0
+
+
+// -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 4 -*-
+
+//
+// Several publisher processes sharing one input directory.
+//
+// usage: bfile_shard_bench <work directory> [files] [processes] [leasetimeout]
+//
+// Runs processes publisher processes on one directory of files files, with
+// the sharding and claim code of the connector (src/dfESPbfileShard.h), once
+// per mode:
+//
+// - hash: shardcount=processes, each process lists the files of its shard.
+//   Also reports the fraction of the files moved from processes-1 shards.
+// - excl and rename: every process claims the files it lists. A first process
+//   claims some files and dies before injecting their events, the others must
+//   take its claims over once leasetimeout (ms) expires.
+//
+// Each process appends the name of every file it publishes to a results file,
+// and the tool checks that every file was published exactly once. The claim of
+// a removed file must also be cleaned up by the next scan with excl. The ESP
+// server is not involved: publishing a file is appending its name.
+//
+// Exit status 0 when every check passed.
+//
+
+#include "../src/dfESPbfileShard.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace std;
+
+static int failures = 0;
+
+static void check(bool ok, const char *what) {
+    if (!ok) {
+        printf("FAILED: %s\n", what);
+        failures++;
+    }
+}
+
+static int64_t monoNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static string fileName(int f) {
+    char name[32];
+    snprintf(name, sizeof(name), "img%06d.jpg", f);
+    return name;
+}
+
+static vector<string> listDir(const string &dir) {
+    vector<string> names;
+    DIR *d = opendir(dir.c_str());
+    if (d) {
+        struct dirent *ent;
+        while ((ent = readdir(d)) != nullptr) {
+            if (ent->d_name[0] != '.') {
+                names.push_back(ent->d_name);
+            }
+        }
+        closedir(d);
+    }
+    return names;
+}
+
+static void removeDir(const string &dir) {
+    for (const string &name : listDir(dir)) {
+        unlink((dir + "/" + name).c_str());
+    }
+    rmdir(dir.c_str());
+}
+
+static bool makeDir(const string &dir, int files) {
+    removeDir(dir);
+    if (mkdir(dir.c_str(), 0755) != 0) {
+        return false;
+    }
+    for (int f = 0; f < files; f++) {
+        FILE *file = fopen((dir + "/" + fileName(f)).c_str(), "w");
+        if (!file) {
+            return false;
+        }
+        fputs("frame", file);
+        fclose(file);
+    }
+    return true;
+}
+
+// one line per published file, O_APPEND keeps the lines of the processes whole
+static void publish(int resultsFd, const string &name, bool takenOver) {
+    string line = name + (takenOver ? "\t1\n" : "\t0\n");
+    if (::write(resultsFd, line.data(), line.size()) < 0) {
+        _exit(2);
+    }
+}
+
+// published files whose claim is completed
+static int doneCount(const string &dir, dfESPbfileShard::mode_t mode) {
+    int done = 0;
+    for (const string &name : listDir(dir)) {
+        struct stat st;
+        if (mode == dfESPbfileShard::mode_RENAME) {
+            done += name.size() > 5 && name.compare(name.size() - 5, 5, ".done") == 0;
+        } else if (name.size() > 6 && name.compare(name.size() - 6, 6, ".claim") == 0 &&
+                   stat((dir + "/" + name).c_str(), &st) == 0 && (st.st_mode & S_IWUSR) == 0) {
+            done++;
+        }
+    }
+    return done;
+}
+
+//
+// one publisher process: scan, claim and publish until every file is done, like the connector directory loop.
+// dieAfter > 0 claims that many files, builds their events and dies before injecting them
+//
+static void publisher(const string &dir, dfESPbfileShard shard, int files, int resultsFd, int dieAfter, int64_t deadlineNs) {
+    char node[64];
+    snprintf(node, sizeof(node), "localhost-%d", (int)getpid());
+    shard.node = node;
+    int claimed = 0;
+    while (monoNs() < deadlineNs) {
+        bool busy = false;
+        for (string name : listDir(dir)) {
+            string leasePath;
+            if (!shard.sortEntry(dir, name, leasePath) || !shard.owns(name)) {
+                continue;
+            }
+            string readName;
+            int64_t takeovers = shard.takeovers;
+            dfESPbfileShard::claim_t claim = shard.claim(dir + "/" + name, leasePath, readName);
+            if (claim == dfESPbfileShard::claim_BUSY) {
+                busy = true;
+                continue;
+            }
+            if (claim != dfESPbfileShard::claim_OWNED) {
+                continue;
+            }
+            if (dieAfter > 0) {
+                if (++claimed == dieAfter) {
+                    _exit(0);
+                }
+                continue;
+            }
+            publish(resultsFd, name, shard.takeovers > takeovers);
+            // the event is injected at once
+            shard.queueComplete(dir + "/" + name, readName);
+            shard.commit();
+        }
+        if (shard.mode == dfESPbfileShard::mode_NONE ? !busy : doneCount(dir, shard.mode) == files) {
+            break;
+        }
+        usleep(50000);
+    }
+    _exit(0);
+}
+
+static void scenario(const string &work, const char *modeName, dfESPbfileShard::mode_t mode, int files, int processes, int64_t leaseTimeoutMs) {
+    string dir = work + "/shard_" + modeName;
+    string results = work + "/shard_" + modeName + ".results";
+    unlink(results.c_str());
+    if (!makeDir(dir, files)) {
+        check(false, "input directory created");
+        return;
+    }
+    int resultsFd = ::open(results.c_str(), O_CREAT | O_WRONLY | O_APPEND, 0644);
+    if (resultsFd < 0) {
+        check(false, "results file created");
+        return;
+    }
+    dfESPbfileShard shard;
+    shard.mode = mode;
+    shard.leaseTimeoutMs = leaseTimeoutMs;
+    int64_t startNs = monoNs();
+    int64_t deadlineNs = startNs + (leaseTimeoutMs * 4 + 30000) * 1000000;
+    int dying = 0;
+    if (mode != dfESPbfileShard::mode_NONE) {
+        // claims files and dies before the others start, so that they find its claims
+        dying = files / 10 > 0 ? files / 10 : 1;
+        pid_t pid = fork();
+        if (pid == 0) {
+            publisher(dir, shard, files, resultsFd, dying, deadlineNs);
+        }
+        waitpid(pid, NULL, 0);
+    } else {
+        shard.count = processes;
+    }
+    vector<pid_t> pids;
+    for (int p = 0; p < processes; p++) {
+        shard.id = p;
+        pid_t pid = fork();
+        if (pid == 0) {
+            publisher(dir, shard, files, resultsFd, 0, deadlineNs);
+        }
+        pids.push_back(pid);
+    }
+    bool exited = true;
+    for (pid_t pid : pids) {
+        int status = 0;
+        waitpid(pid, &status, 0);
+        exited = exited && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    }
+    int64_t elapsedNs = monoNs() - startNs;
+    ::close(resultsFd);
+    check(exited, "publisher processes complete");
+
+    //
+    // every file published once
+    //
+    map<string, int> published;
+    int takenOver = 0;
+    FILE *file = fopen(results.c_str(), "r");
+    char line[256];
+    while (file && fgets(line, sizeof(line), file)) {
+        char *tab = strchr(line, '\t');
+        if (tab) {
+            *tab = '\0';
+            published[line]++;
+            takenOver += tab[1] == '1';
+        }
+    }
+    if (file) {
+        fclose(file);
+    }
+    int once = 0;
+    int twice = 0;
+    for (const auto &name : published) {
+        once += name.second == 1;
+        twice += name.second > 1;
+    }
+    check(once == files && twice == 0, modeName);
+    printf("%-7s %6d files, %d processes: %6d published once, %d more than once, %d missing, %d claims of a dead process taken over, %.3f s\n",
+           modeName, files, processes, once, twice, files - (int)published.size(), takenOver, elapsedNs / 1e9);
+    if (mode != dfESPbfileShard::mode_NONE) {
+        // a freed claim may also be created again by a process that did not take it over
+        check(takenOver > 0 && takenOver <= dying, "claims of the dead process taken over");
+        check(elapsedNs >= leaseTimeoutMs * 1000000, "claims of the dead process kept until leasetimeout");
+    }
+
+    if (mode == dfESPbfileShard::mode_EXCL) {
+        //
+        // the claims of removed files are cleaned by the next scan
+        //
+        for (int f = 0; f < files; f += 2) {
+            unlink((dir + "/" + fileName(f)).c_str());
+        }
+        for (string name : listDir(dir)) {
+            string leasePath;
+            shard.sortEntry(dir, name, leasePath);
+        }
+        int claims = 0;
+        for (const string &name : listDir(dir)) {
+            claims += name.size() > 6 && name.compare(name.size() - 6, 6, ".claim") == 0;
+        }
+        check(claims == files / 2, "claims of removed files cleaned");
+    }
+    removeDir(dir);
+    unlink(results.c_str());
+}
+
+//
+// fraction of the files changing shard from processes-1 to processes shards, ideally 1/processes
+//
+static void moved(int files, int processes) {
+    if (processes < 2) {
+        return;
+    }
+    int count = 0;
+    for (int f = 0; f < files; f++) {
+        uint64_t key = dfESPbfileShard::fnv1a(fileName(f));
+        count += dfESPbfileShard::jumpHash(key, processes - 1) != dfESPbfileShard::jumpHash(key, processes);
+    }
+    printf("%d to %d shards: %.3f of the files moved, ideally %.3f\n", processes - 1, processes, (double)count / files, 1.0 / processes);
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2 || argc > 5) {
+        fprintf(stderr, "usage: %s <work directory> [files] [processes] [leasetimeout]\n", argv[0]);
+        return 2;
+    }
+    string work = argv[1];
+    int files = argc > 2 ? atoi(argv[2]) : 2000;
+    int processes = argc > 3 ? atoi(argv[3]) : 4;
+    int64_t leaseTimeoutMs = argc > 4 ? atoll(argv[4]) : 1000;
+    if (files < 2 || processes < 1 || leaseTimeoutMs < 1) {
+        fprintf(stderr, "files must be at least 2, processes and leasetimeout at least 1\n");
+        return 2;
+    }
+    scenario(work, "hash", dfESPbfileShard::mode_NONE, files, processes, leaseTimeoutMs);
+    moved(files, processes);
+    scenario(work, "excl", dfESPbfileShard::mode_EXCL, files, processes, leaseTimeoutMs);
+    scenario(work, "rename", dfESPbfileShard::mode_RENAME, files, processes, leaseTimeoutMs);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,111 @@
+// Copyright © 2021, SAS Institute Inc., Cary, NC, USA.  All Rights Reserved.
+// SPDX-License-Identifier: Apache-2.0
+
+
+// -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 4 -*-
+
+//
+// Latency summary of a bfile subscriber tracefile.
+//
+// usage: bfile_trace_summary <tracefile>
+//
+// The tracefile columns are id,mtime,readstart,readend,inject,receive,written
+// (microseconds). For each stage, the p50, p99 and max latencies are printed
+// in milliseconds. Events with a missing timestamp are left out of the stages
+// that need it.
+//
+// The inject column is stamped when the publisher queues the event in its
+// current event block, not when the block is injected: with blocksize > 1
+// (or adaptive), "queue to sub" includes the time spent waiting for the
+// block to fill.
+//
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+enum { col_ID, col_MTIME, col_READSTART, col_READEND, col_INJECT, col_RECEIVE, col_WRITTEN, col_COUNT };
+
+struct stage_t {
+    const char *name;
+    int from;
+    int to;
+    vector<int64_t> samples;
+};
+
+static double percentile(const vector<int64_t> &sorted, double p) {
+    size_t rank = static_cast<size_t>(p * (sorted.size() - 1) + 0.5);
+    return sorted[rank] / 1000.0;
+}
+
+int main(int argc, char **argv) {
+    if (argc != 2) {
+        cerr << "usage: " << argv[0] << " <tracefile>" << endl;
+        return 2;
+    }
+    ifstream trace(argv[1]);
+    if (!trace.is_open()) {
+        cerr << "could not open " << argv[1] << endl;
+        return 1;
+    }
+
+    stage_t stages[] = {
+        {"arrival to read", col_MTIME,     col_READSTART, {}},
+        {"read",            col_READSTART, col_READEND,   {}},
+        {"build",           col_READEND,   col_INJECT,    {}},
+        {"queue to sub",    col_INJECT,    col_RECEIVE,   {}},
+        {"write",           col_RECEIVE,   col_WRITTEN,   {}},
+        {"end to end",      col_MTIME,     col_WRITTEN,   {}},
+    };
+    const size_t stageCount = sizeof(stages) / sizeof(stages[0]);
+
+    string line;
+    int64_t events = 0;
+    getline(trace, line); // header
+    while (getline(trace, line)) {
+        int64_t values[col_COUNT];
+        bool present[col_COUNT];
+        istringstream fields(line);
+        string field;
+        int c = 0;
+        while (c < col_COUNT && getline(fields, field, ',')) {
+            present[c] = !field.empty();
+            values[c] = present[c] ? strtoll(field.c_str(), nullptr, 10) : 0;
+            c++;
+        }
+        if (c != col_COUNT && !(c == col_COUNT - 1 && line.back() == ',')) {
+            continue;
+        }
+        for (; c < col_COUNT; c++) {
+            present[c] = false;
+        }
+        events++;
+        for (size_t s = 0; s < stageCount; s++) {
+            if (present[stages[s].from] && present[stages[s].to]) {
+                stages[s].samples.push_back(values[stages[s].to] - values[stages[s].from]);
+            }
+        }
+    }
+
+    printf("%lld events\n", (long long)events);
+    printf("%-16s %10s %10s %10s %10s\n", "stage (ms)", "count", "p50", "p99", "max");
+    for (size_t s = 0; s < stageCount; s++) {
+        vector<int64_t> &samples = stages[s].samples;
+        if (samples.empty()) {
+            printf("%-16s %10d %10s %10s %10s\n", stages[s].name, 0, "-", "-", "-");
+            continue;
+        }
+        sort(samples.begin(), samples.end());
+        printf("%-16s %10zu %10.3f %10.3f %10.3f\n", stages[s].name, samples.size(),
+               percentile(samples, 0.50), percentile(samples, 0.99), samples.back() / 1000.0);
+    }
+    return 0;
+}